@@ -0,0 +1,792 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#include <sys/resource.h>
+
+#include <chrono>
+#include <random>
+#include <set>
+#include <sstream>
+
+#include <seqan/arg_parse.h>
+#include <seqan/binning_directory.h>
+
+#include "helper.h"
+#include "dispatch.h"
+#include "ibf.h"
+#include "minimizer.h"
+#include "minimizer_fixtures.h"
+#include "result_writer.h"
+#include "sample_map.h"
+#include "threshold.h"
+
+using namespace seqan;
+
+struct Options
+{
+    CharString  output_file;
+    CharString  result_file;
+    std::string benchmarks;
+    std::string backend;
+    uint64_t    group_bytes;
+
+    uint32_t    kmer_size;
+    uint32_t    window_size;
+    uint32_t    number_of_bins;
+    uint64_t    size_of_ibf;
+    uint32_t    number_of_hashes;
+    uint64_t    genome_length;
+    uint64_t    number_of_reads;
+    uint32_t    read_length;
+    uint32_t    errors;
+    uint32_t    batch_size;
+    uint64_t    seed;
+    bool        verify;
+    bool        scalar;
+
+    Options():
+        output_file("benchmark.json"),
+        result_file("/dev/null"),
+        benchmarks("parse,minimizer,insert,lookup,select,select-batch,write-text,write-binary"),
+        backend("ibf"),
+        group_bytes(64),
+        kmer_size(19),
+        window_size(23),
+        number_of_bins(64),
+        size_of_ibf(1_g),
+        number_of_hashes(3),
+        genome_length(64000000),
+        number_of_reads(1000000),
+        read_length(100),
+        errors(2),
+        batch_size(64),
+        seed(42),
+        verify(false),
+        scalar(false) {}
+};
+
+void setupArgumentParser(ArgumentParser & parser, Options const & options)
+{
+    setAppName(parser, "SRA_search benchmark");
+    addDescription(parser, "Generates a random reference and reads sampled from it with substitutions, both seeded, "
+                           "and measures parsing, minimizer hashing, filter construction, lookups and their false "
+                           "positive rate, queries and result writing for the given filter shape. Throughput, latency "
+                           "percentiles and the peak memory are written as JSON.");
+
+    addSection(parser, "Output Options");
+
+    addOption(parser, ArgParseOption("o", "output-file", "The JSON file with the measurements.",
+                                     ArgParseOption::OUTPUT_FILE));
+    setDefaultValue(parser, "output-file", options.output_file);
+
+    addOption(parser, ArgParseOption("r", "result-file", "Where the write benchmarks write their results to.",
+                                     ArgParseOption::OUTPUT_FILE));
+    setDefaultValue(parser, "result-file", options.result_file);
+
+    addOption(parser, ArgParseOption("B", "benchmarks", "Comma separated list of the benchmarks to run, out of parse, \
+                                     minimizer, insert, lookup, select, select-batch, write-text and write-binary.",
+                                     ArgParseOption::STRING));
+    setDefaultValue(parser, "benchmarks", options.benchmarks);
+
+    addSection(parser, "Filter Options");
+
+    addOption(parser, ArgParseOption("b", "number-of-bins", "The number of bins", ArgParseOption::INTEGER));
+    setMinValue(parser, "number-of-bins", "1");
+    setMaxValue(parser, "number-of-bins", "4194300");
+    setDefaultValue(parser, "number-of-bins", options.number_of_bins);
+
+    addOption(parser, ArgParseOption("k", "kmer-size", "The size of kmers for the IBF", ArgParseOption::INTEGER));
+    setMinValue(parser, "kmer-size", "14");
+    setMaxValue(parser, "kmer-size", "32");
+    setDefaultValue(parser, "kmer-size", options.kmer_size);
+
+    addOption(parser, ArgParseOption("w", "window-size", "The size of the window for the IBF", ArgParseOption::INTEGER));
+    setMinValue(parser, "window-size", "14");
+    setDefaultValue(parser, "window-size", options.window_size);
+
+    addOption(parser, ArgParseOption("nh", "num-hash", "Specify the number of hash functions to use for the bloom filter.", ArgParseOption::INTEGER));
+    setMinValue(parser, "num-hash", "2");
+    setMaxValue(parser, "num-hash", "5");
+    setDefaultValue(parser, "num-hash", options.number_of_hashes);
+
+    addOption(parser, ArgParseOption("bs", "bloom-size",
+            "The size of bloom filter suffixed by either M or G for megabytes or gigabytes respectively.",
+            ArgParseOption::STRING));
+    setDefaultValue(parser, "bloom-size", "1G");
+
+    addOption(parser, ArgParseOption("ba", "backend", "The backend of the filter, see build.", ArgParseOption::STRING));
+    setValidValues(parser, "backend", "auto ibf blocked direct");
+
+    addOption(parser, ArgParseOption("bg", "block-group", "The memory that all hash functions of a minimizer share \
+                                     with --backend blocked: a cache line saves the most cache misses, a page keeps \
+                                     the false positive rate close to the one of ibf.", ArgParseOption::STRING));
+    setValidValues(parser, "block-group", "line page");
+    setDefaultValue(parser, "block-group", "line");
+    setDefaultValue(parser, "backend", options.backend);
+
+    addSection(parser, "Data Options");
+
+    addOption(parser, ArgParseOption("g", "genome-length", "The number of bases of the reference, split evenly \
+                                     into the bins.", ArgParseOption::INT64));
+    setMinValue(parser, "genome-length", "1");
+    setDefaultValue(parser, "genome-length", options.genome_length);
+
+    addOption(parser, ArgParseOption("n", "number-of-reads", "The number of reads.", ArgParseOption::INT64));
+    setMinValue(parser, "number-of-reads", "1");
+    setDefaultValue(parser, "number-of-reads", options.number_of_reads);
+
+    addOption(parser, ArgParseOption("l", "read-length", "The length of the reads.", ArgParseOption::INTEGER));
+    setMinValue(parser, "read-length", "1");
+    setDefaultValue(parser, "read-length", options.read_length);
+
+    addOption(parser, ArgParseOption("e", "error", "The number of substitutions in each read and the number of \
+                                     errors the queries allow.", ArgParseOption::INTEGER));
+    setMinValue(parser, "error", "0");
+    setMaxValue(parser, "error", "3");
+    setDefaultValue(parser, "error", options.errors);
+
+    addOption(parser, ArgParseOption("q", "query-batch", "The number of reads queried together by select-batch.",
+                                     ArgParseOption::INTEGER));
+    setMinValue(parser, "query-batch", "1");
+    setDefaultValue(parser, "query-batch", options.batch_size);
+
+    addOption(parser, ArgParseOption("S", "seed", "The seed of the random generator.", ArgParseOption::INT64));
+    setDefaultValue(parser, "seed", options.seed);
+
+    addOption(parser, ArgParseOption("v", "verify", "Compare the minimizers with the ones of the SeqAn implementation: \
+                                     for every supported (k, w) on sequences with runs of N and of the lengths that \
+                                     need special handling, and for the benchmark reads. The minimizers are also \
+                                     checked against fixed expected ones."));
+    addOption(parser, ArgParseOption("s", "scalar", "Use the scalar minimizer kernels even if the CPU supports AVX2."));
+}
+
+ArgumentParser::ParseResult
+parseCommandLine(Options & options, ArgumentParser & parser, int argc, char const ** argv)
+{
+    ArgumentParser::ParseResult res = parse(parser, argc, argv);
+
+    if (res != ArgumentParser::PARSE_OK)
+        return res;
+
+    getOptionValue(options.output_file, parser, "output-file");
+    getOptionValue(options.result_file, parser, "result-file");
+    getOptionValue(options.benchmarks, parser, "benchmarks");
+    getOptionValue(options.backend, parser, "backend");
+    std::string block_group;
+    if (getOptionValue(block_group, parser, "block-group"))
+        options.group_bytes = block_group == "page" ? 4096 : 64;
+    if (isSet(parser, "number-of-bins")) getOptionValue(options.number_of_bins, parser, "number-of-bins");
+    if (isSet(parser, "kmer-size")) getOptionValue(options.kmer_size, parser, "kmer-size");
+    if (isSet(parser, "window-size")) getOptionValue(options.window_size, parser, "window-size");
+    if (isSet(parser, "num-hash")) getOptionValue(options.number_of_hashes, parser, "num-hash");
+    if (isSet(parser, "genome-length")) getOptionValue(options.genome_length, parser, "genome-length");
+    if (isSet(parser, "number-of-reads")) getOptionValue(options.number_of_reads, parser, "number-of-reads");
+    if (isSet(parser, "read-length")) getOptionValue(options.read_length, parser, "read-length");
+    if (isSet(parser, "error")) getOptionValue(options.errors, parser, "error");
+    if (isSet(parser, "query-batch")) getOptionValue(options.batch_size, parser, "query-batch");
+    if (isSet(parser, "seed")) getOptionValue(options.seed, parser, "seed");
+    options.verify = isSet(parser, "verify");
+    options.scalar = isSet(parser, "scalar");
+
+    std::string ibf_size;
+    if (getOptionValue(ibf_size, parser, "bloom-size"))
+    {
+        uint64_t base = std::stoi(ibf_size);
+        switch (ibf_size.at(ibf_size.size()-1))
+        {
+            case 'G': case 'g':
+                options.size_of_ibf =  base * 8*1024*1024*1024;
+                break;
+            case 'M': case 'm':
+                options.size_of_ibf =  base * 8*1024*1024;
+                break;
+            default:
+                std::cerr <<"[ERROR] invalid --bloom-size (-bs) parameter provided. (eg 256M, 1g)" << std::endl;
+                exit(1);
+        }
+    }
+    // The measurements record the backend that was used.
+    options.backend = backend_name(choose_backend(options.backend, options.number_of_bins, options.kmer_size,
+                                                  options.size_of_ibf));
+    return ArgumentParser::PARSE_OK;
+}
+
+// ----------------------------------------------------------------------------
+// Class SyntheticData
+// ----------------------------------------------------------------------------
+// A random reference with about one N per 10000 bases, and reads of which 90%
+// are sampled from the reference, half of them reverse complemented, with
+// `errors` substitutions each. The other 10% are random and should not be
+// found. The same seed always gives the same data.
+
+struct SyntheticData
+{
+    std::vector<uint8_t>    genome;
+    RecordBatch             reads;
+    std::string             fastq;
+
+    SyntheticData(Options const & options)
+    {
+        std::mt19937_64 random(options.seed);
+        genome.resize(options.genome_length);
+        for (uint8_t & base : genome)
+            base = random() % 10000 == 0 ? 4 : random() % 4;
+
+        std::vector<uint8_t> read(options.read_length);
+        std::string id;
+        for (uint64_t r = 0; r < options.number_of_reads; ++r)
+        {
+            uint64_t kind = random() % 20;
+            if (kind < 2 || genome.size() < read.size())
+            {
+                for (uint8_t & base : read)
+                    base = random() % 4;
+            }
+            else
+            {
+                uint64_t begin = random() % (genome.size() - read.size() + 1);
+                for (size_t i = 0; i < read.size(); ++i)
+                    read[i] = kind % 2 ? genome[begin + i] : complement(genome[begin + read.size() - 1 - i]);
+                for (uint32_t e = 0; e < options.errors; ++e)
+                {
+                    uint8_t & base = read[random() % read.size()];
+                    base = (base + 1 + random() % 3) % 4;
+                }
+            }
+            id = "read" + std::to_string(r);
+            reads.push_back(FastxRecord{IdView{id.data(), id.size()}, RankView{read.data(), read.size()}});
+
+            fastq.append("@").append(id).append("\n");
+            for (uint8_t base : read)
+                fastq.push_back("ACGTN"[base]);
+            fastq.append("\n+\n").append(read.size(), 'I').append("\n");
+        }
+    }
+
+    static uint8_t complement(uint8_t rank)
+    {
+        return rank == 4 ? 4 : 3 - rank;
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Class Measurement
+// ----------------------------------------------------------------------------
+// The result of one benchmark. A latency is recorded per item or per batch of
+// items, timer overhead of about 20ns included. max_rss_kib is the peak
+// resident memory of the process up to the end of the benchmark, which
+// includes the synthetic data and, from insert on, the filter.
+
+struct Measurement
+{
+    std::string             name;
+    std::string             unit;
+    uint64_t                items;
+    uint64_t                bases;
+    uint64_t                bytes;
+    double                  seconds;
+    std::vector<uint64_t>   latencies;
+    long                    max_rss_kib;
+    // Measured and predicted per bin, negative if the benchmark does not measure it.
+    double                  false_positive_rate;
+    double                  predicted_false_positive_rate;
+
+    Measurement(std::string name, std::string unit) :
+        name(name),
+        unit(unit),
+        items(0),
+        bases(0),
+        bytes(0),
+        seconds(0),
+        false_positive_rate(-1),
+        predicted_false_positive_rate(-1) {}
+};
+
+typedef std::chrono::steady_clock Clock;
+
+inline uint64_t elapsed_ns(Clock::time_point start, Clock::time_point end)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+inline void finish(Measurement & measurement, double seconds)
+{
+    measurement.seconds = seconds;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    measurement.max_rss_kib = usage.ru_maxrss;
+}
+
+inline uint64_t percentile(std::vector<uint64_t> const & sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    return sorted[std::min<uint64_t>(sorted.size() - 1, p * sorted.size())];
+}
+
+// ----------------------------------------------------------------------------
+// Function write_json()
+// ----------------------------------------------------------------------------
+
+inline void write_json(Options const & options, std::vector<Measurement> & measurements)
+{
+    std::ofstream out(toCString(options.output_file));
+    out << "{\n"
+        << "  \"parameters\": {\n"
+        << "    \"bins\": " << options.number_of_bins << ",\n"
+        << "    \"kmer_size\": " << options.kmer_size << ",\n"
+        << "    \"window_size\": " << options.window_size << ",\n"
+        << "    \"backend\": \"" << options.backend << "\",\n"
+        << "    \"group_bytes\": " << options.group_bytes << ",\n"
+        << "    \"hashes\": " << options.number_of_hashes << ",\n"
+        << "    \"ibf_bits\": " << options.size_of_ibf << ",\n"
+        << "    \"genome_length\": " << options.genome_length << ",\n"
+        << "    \"reads\": " << options.number_of_reads << ",\n"
+        << "    \"read_length\": " << options.read_length << ",\n"
+        << "    \"errors\": " << options.errors << ",\n"
+        << "    \"query_batch\": " << options.batch_size << ",\n"
+        << "    \"seed\": " << options.seed << ",\n"
+        << "    \"simd\": " << (options.scalar ? "false" : "true") << "\n"
+        << "  },\n"
+        << "  \"results\": [";
+    for (size_t i = 0; i < measurements.size(); ++i)
+    {
+        Measurement & m = measurements[i];
+        std::sort(m.latencies.begin(), m.latencies.end());
+        uint64_t total{0};
+        for (uint64_t latency : m.latencies)
+            total += latency;
+        out << (i ? "," : "") << "\n    {\n"
+            << "      \"name\": \"" << m.name << "\",\n"
+            << "      \"unit\": \"" << m.unit << "\",\n"
+            << "      \"items\": " << m.items << ",\n"
+            << "      \"bases\": " << m.bases << ",\n"
+            << "      \"bytes\": " << m.bytes << ",\n"
+            << "      \"seconds\": " << m.seconds << ",\n"
+            << "      \"items_per_second\": " << (m.seconds > 0 ? m.items / m.seconds : 0) << ",\n"
+            << "      \"bases_per_second\": " << (m.seconds > 0 ? m.bases / m.seconds : 0) << ",\n"
+            << "      \"bytes_per_second\": " << (m.seconds > 0 ? m.bytes / m.seconds : 0) << ",\n"
+            << "      \"latency_ns\": {\"samples\": " << m.latencies.size()
+            << ", \"mean\": " << (m.latencies.empty() ? 0 : total / m.latencies.size())
+            << ", \"p50\": " << percentile(m.latencies, 0.5)
+            << ", \"p90\": " << percentile(m.latencies, 0.9)
+            << ", \"p99\": " << percentile(m.latencies, 0.99)
+            << ", \"p999\": " << percentile(m.latencies, 0.999)
+            << ", \"max\": " << (m.latencies.empty() ? 0 : m.latencies.back()) << "},\n";
+        if (m.false_positive_rate >= 0)
+        {
+            out << "      \"false_positive_rate\": " << m.false_positive_rate << ",\n"
+                << "      \"predicted_false_positive_rate\": " << m.predicted_false_positive_rate << ",\n";
+        }
+        out << "      \"max_rss_kib\": " << m.max_rss_kib << "\n"
+            << "    }";
+    }
+    out << "\n  ]\n}\n";
+    if (!out)
+        throw IOError("Unable to write output file: " + std::string(toCString(options.output_file)));
+
+    for (Measurement const & m : measurements)
+    {
+        std::cerr << m.name << ": " << (m.seconds > 0 ? m.items / m.seconds : 0) << ' ' << m.unit << "/s, p50 "
+                  << percentile(m.latencies, 0.5) << "ns, p99 " << percentile(m.latencies, 0.99) << "ns";
+        if (m.false_positive_rate >= 0)
+            std::cerr << ", false positive rate " << m.false_positive_rate << " (predicted "
+                      << m.predicted_false_positive_rate << ")";
+        std::cerr << '\n';
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Function verify_minimizers()
+// ----------------------------------------------------------------------------
+// Compares MinimizerHash, with and without the AVX2 kernels, against the SeqAn
+// implementation for every supported (k, w). The sequences cover the cases
+// where they could disagree: runs of N at the start, in the middle and at the
+// end, only N, texts of length k - 1, k, between k and w, w and w + 1, and
+// random texts on both sides of the length from which AVX2 is used. Both are
+// also checked against the fixed minimizers of minimizer_fixtures(), which do
+// not change along with either implementation. Returns the number of
+// sequences with different minimizers.
+
+inline uint64_t verify_minimizers(MinimizerList<>)
+{
+    return 0;
+}
+
+template <uint16_t k, uint32_t w, typename ... TRest>
+inline uint64_t verify_minimizers(MinimizerList<Minimizer<k, w>, TRest...>)
+{
+    std::mt19937_64 generator(k * 1000 + w);
+    auto random_text = [&] (uint64_t text_length, char const * alphabet, uint64_t alphabet_size) {
+        std::string text(text_length, 'A');
+        for (char & base : text)
+            base = alphabet[generator() % alphabet_size];
+        return text;
+    };
+
+    std::vector<std::string> texts;
+    for (uint64_t text_length : {k - 1u, k + 0u, k + 1u, (k + w) / 2u, w - 1u, w + 0u, w + 1u})
+        texts.push_back(random_text(text_length, "ACGT", 4));
+    std::string with_n = random_text(3 * w + 40, "ACGT", 4);
+    std::fill(with_n.begin(), with_n.begin() + k + 2, 'N');
+    std::fill(with_n.begin() + w + 5, with_n.begin() + 2 * w + 5, 'N');
+    std::fill(with_n.end() - (k - 1), with_n.end(), 'N');
+    texts.push_back(with_n);
+    texts.push_back(std::string(w + 10, 'N'));
+    texts.push_back(std::string(k, 'N'));
+    for (uint64_t text_length = w; text_length < w + 300; text_length += 7)
+        texts.push_back(random_text(text_length, "ACGTN", 5));
+    for (uint64_t text_length = k; text_length <= w; ++text_length)
+        texts.push_back(random_text(text_length, "ACGTN", 5));
+
+    BDHash<Dna5, Minimizer<k, w>> reference;
+    MinimizerHash<Dna5, Minimizer<k, w>> hasher;
+    MinimizerHash<Dna5, Minimizer<k, w>> scalar_hasher;
+    reference.resize(k, w);
+    hasher.resize(k, w);
+    scalar_hasher.resize(k, w);
+    scalar_hasher.use_simd(false);
+    uint64_t mismatches{0};
+    for (std::string const & text : texts)
+    {
+        Dna5String dna = text.c_str();
+        std::vector<uint64_t> expected = reference.getHash(dna);
+        if (hasher.getHash(dna) != expected || scalar_hasher.getHash(dna) != expected)
+            ++mismatches;
+    }
+
+    std::vector<std::string> const fixture_texts = minimizer_fixture_texts(k, w);
+    uint64_t fixtures{0};
+    for (MinimizerFixture const & fixture : minimizer_fixtures())
+    {
+        if (fixture.kmer_size != k || fixture.window_size != w)
+            continue;
+        ++fixtures;
+        Dna5String dna = fixture_texts[fixture.text].c_str();
+        for (std::vector<uint64_t> const & hashes : {hasher.getHash(dna), scalar_hasher.getHash(dna)})
+        {
+            if (hashes.size() != fixture.count || minimizer_digest(hashes) != fixture.digest)
+            {
+                ++mismatches;
+                break;
+            }
+        }
+    }
+    std::cerr << "(" << k << ", " << w << "): " << mismatches << " of " << texts.size() + fixtures
+              << " sequences with different minimizers" << std::endl;
+    return mismatches + verify_minimizers(MinimizerList<TRest...>());
+}
+
+template <typename TMinimizer>
+inline void run_benchmarks(Options & options)
+{
+    std::set<std::string> selected;
+    std::istringstream list(options.benchmarks);
+    for (std::string name; std::getline(list, name, ',');)
+        selected.insert(name);
+    auto run = [&] (std::string const & name) { return selected.count(name) > 0; };
+    bool query = run("lookup") || run("select") || run("select-batch") || run("write-text") || run("write-binary");
+
+    std::cerr << "Generating data..." << std::endl;
+    SyntheticData data(options);
+    std::vector<Measurement> measurements;
+
+    MinimizerHash<Dna5, TMinimizer> hasher;
+    hasher.resize(options.kmer_size, options.window_size);
+    hasher.use_simd(!options.scalar);
+    std::vector<uint64_t> kmer_hashes;
+
+    if (run("parse"))
+    {
+        Measurement m("parse", "reads");
+        FastxReader reader(std::unique_ptr<BlockSource>(new MemorySource(data.fastq)));
+        FastxRecord record;
+        auto start = Clock::now();
+        while (true)
+        {
+            auto before = Clock::now();
+            if (!reader.next(record))
+                break;
+            m.latencies.push_back(elapsed_ns(before, Clock::now()));
+            m.bases += record.seq.size;
+            ++m.items;
+        }
+        m.bytes = data.fastq.size();
+        finish(m, elapsed_ns(start, Clock::now()) / 1e9);
+        measurements.push_back(m);
+    }
+
+    if (run("minimizer"))
+    {
+        Measurement m("minimizer", "reads");
+        auto start = Clock::now();
+        for (uint64_t r = 0; r < length(data.reads); ++r)
+        {
+            auto before = Clock::now();
+            hasher.getHash(data.reads[r], kmer_hashes);
+            m.latencies.push_back(elapsed_ns(before, Clock::now()));
+            m.bases += length(data.reads[r]);
+            ++m.items;
+        }
+        finish(m, elapsed_ns(start, Clock::now()) / 1e9);
+        measurements.push_back(m);
+
+        if (options.verify)
+        {
+            BDHash<Dna5, TMinimizer> reference;
+            reference.resize(options.kmer_size, options.window_size);
+            Dna5String dna;
+            uint64_t mismatches{0};
+            for (uint64_t r = 0; r < length(data.reads); ++r)
+            {
+                // The SeqAn implementation needs a Dna5String.
+                RankView read = data.reads[r];
+                resize(dna, length(read));
+                for (size_t i = 0; i < length(read); ++i)
+                    dna[i] = read[i];
+                if (hasher.getHash(read) != reference.getHash(dna))
+                    ++mismatches;
+            }
+            std::cerr << "Sequences with different minimizers: " << mismatches << '\n';
+            if (mismatches != 0)
+                throw RuntimeError("The minimizers differ from the SeqAn implementation or the fixed expected ones.");
+        }
+    }
+
+    if (!run("insert") && !query)
+    {
+        write_json(options, measurements);
+        return;
+    }
+
+    // Every bin gets an equal slice of the genome. The minimizers of a chunk are computed before the clock starts,
+    // so that only the insertion is measured; flushing the buffered positions is part of the total time.
+    IbfBuilder builder(options.number_of_bins, options.number_of_hashes, options.kmer_size, options.window_size,
+                       options.size_of_ibf, 1,
+                       choose_backend(options.backend, options.number_of_bins, options.kmer_size, options.size_of_ibf),
+                       IbfLayout::default_group_blocks((options.number_of_bins + 63) / 64, options.group_bytes));
+    // Number of distinct minimizers per bin for the predicted false positive rate, consecutive windows of the
+    // random genome only share their minimizer if it is the same k-mer.
+    uint64_t distinct_minimizers{0};
+    {
+        Measurement m("insert", "k-mers");
+        uint64_t const chunk_size = 1 << 16;
+        uint64_t const slice = (data.genome.size() + options.number_of_bins - 1) / options.number_of_bins;
+        double seconds{0};
+        {
+            IbfBuilder::Inserter inserter(builder);
+            for (uint64_t bin_number = 0; bin_number < options.number_of_bins; ++bin_number)
+            {
+                uint64_t const bin_end = std::min<uint64_t>(data.genome.size(), (bin_number + 1) * slice);
+                for (uint64_t begin = bin_number * slice; begin < bin_end; begin += chunk_size)
+                {
+                    // Chunks overlap by one window, so no window of the slice is lost.
+                    uint64_t const end = std::min<uint64_t>(bin_end, begin + chunk_size + options.window_size - 1);
+                    hasher.getHash(RankView{data.genome.data() + begin, end - begin}, kmer_hashes);
+                    for (uint64_t i = 0; i < kmer_hashes.size(); ++i)
+                        distinct_minimizers += i == 0 || kmer_hashes[i] != kmer_hashes[i - 1];
+                    auto before = Clock::now();
+                    for (uint64_t kmer_hash : kmer_hashes)
+                        inserter.insert(kmer_hash, bin_number);
+                    uint64_t ns = elapsed_ns(before, Clock::now());
+                    m.latencies.push_back(ns);
+                    seconds += ns / 1e9;
+                    m.items += kmer_hashes.size();
+                    m.bases += std::min(chunk_size, bin_end - begin);
+                }
+            }
+            auto before = Clock::now();
+            inserter.flush();
+            seconds += elapsed_ns(before, Clock::now()) / 1e9;
+        }
+        finish(m, seconds);
+        if (run("insert"))
+            measurements.push_back(m);
+    }
+
+    Ibf<Dna5, TMinimizer> filter(builder);
+    ThresholdTable thresholds(options.errors, 0);
+    IbfSelector<Dna5, TMinimizer> selector(filter);
+    uint64_t const kmer_size = getKmerSize(filter);
+    // The bins found by select are kept for the write benchmarks.
+    std::vector<std::vector<uint32_t>> bins(length(data.reads));
+    auto get_bins = [] (std::vector<uint64_t> const & mask, std::vector<uint32_t> & bins) {
+        bins.clear();
+        for_each_bin(mask, [&] (uint64_t bin_number) { bins.push_back(bin_number); });
+    };
+
+    if (run("lookup"))
+    {
+        // Random minimizer values, almost all of them are in no bin. Every bin a lookup reports is a false positive,
+        // the measured rate is compared to the one predicted from the layout. Latencies are per 4096 lookups.
+        Measurement m("lookup", "k-mers");
+        IbfLayout const & layout = filter.layout;
+        uint64_t const * words = filter.data();
+        uint64_t const value_mask = kmer_size >= 32 ? ~0ULL : (1ULL << (2 * kmer_size)) - 1;
+        std::mt19937_64 random(options.seed + 1);
+        std::vector<uint64_t> values(options.number_of_reads);
+        for (uint64_t & value : values)
+            value = random() & value_mask;
+
+        uint64_t false_positives{0};
+        auto start = Clock::now();
+        for (uint64_t first = 0; first < values.size(); first += 4096)
+        {
+            auto before = Clock::now();
+            for (uint64_t v = first; v < std::min<uint64_t>(first + 4096, values.size()); ++v)
+            {
+                for (uint64_t w = 0; w < layout.bin_width; ++w)
+                {
+                    uint64_t bits = words[layout.block_word(values[v], 0) + w];
+                    for (uint64_t i = 1; i < layout.number_of_hashes; ++i)
+                        bits &= words[layout.block_word(values[v], i) + w];
+                    false_positives += __builtin_popcountll(bits);
+                }
+            }
+            m.latencies.push_back(elapsed_ns(before, Clock::now()));
+        }
+        m.items = values.size();
+        finish(m, elapsed_ns(start, Clock::now()) / 1e9);
+        m.false_positive_rate = static_cast<double>(false_positives) / values.size() / options.number_of_bins;
+        m.predicted_false_positive_rate = false_positive_rate(layout, static_cast<double>(distinct_minimizers) /
+                                                                      options.number_of_bins);
+        measurements.push_back(m);
+    }
+
+    if (query)
+    {
+        Measurement m("select", "reads");
+        auto start = Clock::now();
+        for (uint64_t r = 0; r < length(data.reads); ++r)
+        {
+            if (length(data.reads[r]) < kmer_size)
+                continue;
+            auto before = Clock::now();
+            std::vector<uint64_t> const & mask = select(selector, data.reads[r], thresholds);
+            m.latencies.push_back(elapsed_ns(before, Clock::now()));
+            get_bins(mask, bins[r]);
+            m.bases += length(data.reads[r]);
+            ++m.items;
+        }
+        finish(m, elapsed_ns(start, Clock::now()) / 1e9);
+        if (run("select"))
+            measurements.push_back(m);
+    }
+
+    if (run("select-batch"))
+    {
+        // Latencies are per batch.
+        Measurement m("select-batch", "reads");
+        uint64_t const number_of_reads = length(data.reads);
+        uint64_t mismatches{0};
+        std::vector<uint32_t> batch_bins;
+        auto start = Clock::now();
+        for (uint64_t r = 0; r < number_of_reads; r += options.batch_size)
+        {
+            auto before = Clock::now();
+            select_batch(selector, data.reads, r, std::min<uint64_t>(r + options.batch_size, number_of_reads),
+                         thresholds, [&] (uint64_t read, std::vector<uint64_t> const & mask) {
+                m.bases += length(data.reads[read]);
+                ++m.items;
+                get_bins(mask, batch_bins);
+                mismatches += batch_bins != bins[read];
+            });
+            m.latencies.push_back(elapsed_ns(before, Clock::now()));
+        }
+        finish(m, elapsed_ns(start, Clock::now()) / 1e9);
+        measurements.push_back(m);
+        if (mismatches != 0)
+            throw RuntimeError("select-batch and select disagree for " + std::to_string(mismatches) + " reads.");
+    }
+
+    SampleMap samples;
+    identity_sample_map(samples, options.number_of_bins);
+    for (ResultFormat format : {RESULT_TEXT, RESULT_BINARY})
+    {
+        std::string name = format == RESULT_TEXT ? "write-text" : "write-binary";
+        if (!run(name))
+            continue;
+
+        Measurement m(name, "reads");
+        ResultWriter out(options.result_file, format, samples.names.size());
+        SampleSet hits(samples.names.size());
+        std::string text;
+        auto start = Clock::now();
+        for (uint64_t r = 0; r < length(data.reads); ++r)
+        {
+            auto before = Clock::now();
+            for (uint32_t bin_number : bins[r])
+                hits.insert(samples.bin_to_sample[bin_number]);
+            append_result(text, format, r, data.reads.id(r), hits, samples);
+            out.write(text);
+            m.latencies.push_back(elapsed_ns(before, Clock::now()));
+            m.bytes += text.size();
+            text.clear();
+            ++m.items;
+        }
+        out.close();
+        finish(m, elapsed_ns(start, Clock::now()) / 1e9);
+        measurements.push_back(m);
+    }
+
+    write_json(options, measurements);
+}
+
+int main(int argc, char const ** argv)
+{
+    ArgumentParser parser;
+    Options options;
+    setupArgumentParser(parser, options);
+
+    ArgumentParser::ParseResult res = parseCommandLine(options, parser, argc, argv);
+
+    if (res != ArgumentParser::PARSE_OK)
+        return res == ArgumentParser::PARSE_ERROR;
+
+    try
+    {
+        if (options.verify && verify_minimizers(SupportedMinimizers()) != 0)
+            throw RuntimeError("The minimizers differ from the SeqAn implementation.");
+        dispatch_minimizer(options.kmer_size, options.window_size, [&] (auto tag) {
+            run_benchmarks<typename decltype(tag)::Type>(options);
+        });
+    }
+    catch (Exception const & e)
+    {
+        std::cerr << getAppName(parser) << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
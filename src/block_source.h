@@ -0,0 +1,133 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#ifndef SRA_SEARCH_BLOCK_SOURCE_H_
+#define SRA_SEARCH_BLOCK_SOURCE_H_
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <seqan/basic.h>
+#include <seqan/sequence.h>
+
+using namespace seqan;
+
+// ----------------------------------------------------------------------------
+// Class BlockSource
+// ----------------------------------------------------------------------------
+// Where a FastxReader gets its bytes from.
+
+class BlockSource
+{
+public:
+    virtual ~BlockSource() {}
+
+    // Reads up to size bytes, returns 0 at the end of the input.
+    virtual size_t read(char * buffer, size_t size) = 0;
+};
+
+// ----------------------------------------------------------------------------
+// Class FileSource
+// ----------------------------------------------------------------------------
+// An uncompressed file read from offset begin on.
+
+class FileSource : public BlockSource
+{
+public:
+    FileSource(CharString const & file_name, uint64_t begin = 0) :
+        fd(::open(toCString(file_name), O_RDONLY)),
+        offset(begin)
+    {
+        if (fd == -1)
+            throw IOError("Unable to open file: " + std::string(toCString(file_name)));
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fd, begin, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    }
+
+    ~FileSource()
+    {
+        ::close(fd);
+    }
+
+    size_t read(char * buffer, size_t size) override
+    {
+        ssize_t bytes;
+        do
+            bytes = ::pread(fd, buffer, size, offset);
+        while (bytes == -1 && errno == EINTR);
+        if (bytes == -1)
+            throw IOError("Unable to read file.");
+        offset += bytes;
+        return bytes;
+    }
+
+private:
+    int         fd;
+    uint64_t    offset;
+};
+
+// ----------------------------------------------------------------------------
+// Class MemorySource
+// ----------------------------------------------------------------------------
+// A string in memory, e.g. a batch of reads received by the query server. The
+// string must outlive the source.
+
+class MemorySource : public BlockSource
+{
+public:
+    MemorySource(std::string const & text) :
+        text(text),
+        position(0) {}
+
+    size_t read(char * buffer, size_t size) override
+    {
+        size_t bytes = std::min(size, text.size() - position);
+        std::memcpy(buffer, text.data() + position, bytes);
+        position += bytes;
+        return bytes;
+    }
+
+private:
+    std::string const & text;
+    size_t              position;
+};
+
+#endif  // SRA_SEARCH_BLOCK_SOURCE_H_
@@ -32,10 +32,20 @@
 // Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
 // ==========================================================================
 
+#include <cstdio>
+
 #include <seqan/arg_parse.h>
 #include <seqan/binning_directory.h>
 
 #include "helper.h"
+#include "dispatch.h"
+#include "external_builder.h"
+#include "hierarchy.h"
+#include "hyperloglog.h"
+#include "ibf.h"
+#include "minimizer.h"
+#include "sample_map.h"
+#include "shards.h"
 
 using namespace seqan;
 
@@ -43,21 +53,40 @@ struct Options
 {
     CharString  contigs_dir;
     CharString  filter_file;
+    CharString  sample_table;
+    CharString  stats_file;
+    CharString  tmp_dir;
+    std::string backend;
+    uint64_t    group_bytes;
+    double      fpr;
 
     uint32_t    kmer_size;
     uint32_t    window_size;
     uint32_t    number_of_bins;
     uint64_t    size_of_ibf;
+    uint64_t    memory;
     uint32_t    number_of_hashes;
+    uint32_t    number_of_shards;
+    uint32_t    hierarchy_bins;
     unsigned    threads;
+    bool        update;
+    bool        stats;
 
     Options():
+        backend("auto"),
+        group_bytes(64),
+        fpr(0),
         kmer_size(19),
         window_size(23),
         number_of_bins(64),
         size_of_ibf(16_g),
+        memory(0),
         number_of_hashes(3),
-        threads(1) {}
+        number_of_shards(1),
+        hierarchy_bins(0),
+        threads(1),
+        update(false),
+        stats(false) {}
 };
 
 void setupArgumentParser(ArgumentParser & parser, Options const & options)
@@ -73,6 +102,12 @@ void setupArgumentParser(ArgumentParser & parser, Options const & options)
                                      Default: use the directory name of reference genomes.", ArgParseOption::OUTPUT_FILE));
     setValidValues(parser, "output-file", "filter");
 
+    addOption(parser, ArgParseOption("s", "sample-map", "A tab separated table assigning a sample name to every bin \
+                                     (bin number, sample name). It is stored next to the filter as <output-file>.samples \
+                                     and search reports the samples instead of the bin numbers.",
+                                     ArgParseOption::INPUT_FILE));
+    setValidValues(parser, "sample-map", "tsv txt");
+
     addOption(parser, ArgParseOption("b", "number-of-bins", "The number of bins",
                                      ArgParseOption::INTEGER));
 
@@ -102,6 +137,82 @@ void setupArgumentParser(ArgumentParser & parser, Options const & options)
             "The size of bloom filter suffixed by either M or G for megabytes or gigabytes respectively.",
             ArgParseOption::STRING));
     setDefaultValue(parser, "bloom-size", "1G");
+
+    addOption(parser, ArgParseOption("", "fpr", "Size the filter for this false positive rate of a minimizer lookup \
+                                     instead of --bloom-size and --num-hash. A first pass over the bins estimates the \
+                                     distinct minimizers of every bin, the filter gets the smallest size and number \
+                                     of hash functions that keep the rate of the largest bin below the target. With \
+                                     --shards every shard is sized for its own largest bin.", ArgParseOption::DOUBLE));
+
+    addOption(parser, ArgParseOption("ba", "backend", "How minimizers are mapped to the blocks of the filter: ibf \
+                                     hashes them --num-hash times into --bloom-size bits, blocked does the same within \
+                                     one cache line (or page) per minimizer, which saves cache misses for a slightly \
+                                     higher false positive rate, direct has one block for every k-mer value (4^k \
+                                     blocks), which answers a lookup with a single access and without false \
+                                     positives. auto takes direct if it fits into --bloom-size and ibf otherwise. The \
+                                     backend is stored in the filter.", ArgParseOption::STRING));
+    setValidValues(parser, "backend", "auto ibf blocked direct");
+
+    addOption(parser, ArgParseOption("bg", "block-group", "The memory that all hash functions of a minimizer share \
+                                     with --backend blocked: a cache line saves the most cache misses, a page keeps \
+                                     the false positive rate close to the one of ibf.", ArgParseOption::STRING));
+    setValidValues(parser, "block-group", "line page");
+    setDefaultValue(parser, "block-group", "line");
+    setDefaultValue(parser, "backend", options.backend);
+
+    addOption(parser, ArgParseOption("sh", "shards", "Split the filter into this many shards over consecutive bins. \
+                                     The output file then is a manifest of the shard files <output-file>.shard<i>, \
+                                     which search queries one after the other. --bloom-size is the size of all \
+                                     shards together.", ArgParseOption::INTEGER));
+    setMinValue(parser, "shards", "1");
+    setDefaultValue(parser, "shards", options.number_of_shards);
+
+    addOption(parser, ArgParseOption("hb", "hierarchy-bins", "Build a hierarchical filter for many bins of skewed \
+                                     sizes. The bins are merged by file size into this many technical bins of a \
+                                     top-level filter, every technical bin of several bins gets a lower-level filter \
+                                     that search only queries if the technical bin is hit. The output file then is a \
+                                     manifest of the filters, --bloom-size is the size of the top level and the lower \
+                                     levels are sized for their largest bin. All levels use --backend, auto is ibf.", \
+                                     ArgParseOption::INTEGER));
+    setMinValue(parser, "hierarchy-bins", "1");
+
+    addOption(parser, ArgParseOption("m", "memory", "Build filters larger than this, suffixed by M or G, out of core: \
+                                     the minimizers are written as sorted runs per region of the filter to \
+                                     --tmp-dir, then the filter is written region by region. The build then takes \
+                                     about this much memory instead of the size of the filter. Every thread buffers \
+                                     every region, so the limit has to grow with --threads; the build stops up front \
+                                     and reports the minimum if it is too small.",
+                                     ArgParseOption::STRING));
+
+    addOption(parser, ArgParseOption("", "tmp-dir", "The directory of the temporary runs of --memory. Default: the \
+                                     directory of the output file.", ArgParseOption::STRING));
+
+    addOption(parser, ArgParseOption("u", "update", "Update the existing filter given by --output-file in place. \
+                                     Every file of the reference directory is named by its bin number, existing bins \
+                                     are cleared and refilled, new bins are added. The number of hash functions, \
+                                     k-mer and window size of the filter are kept."));
+
+    addOption(parser, ArgParseOption("", "stats", "Print the time spent per stage (read, hash, insert, write) and \
+                                     the hardware counters of the worker threads."));
+    addOption(parser, ArgParseOption("", "stats-file", "Write the stats as JSON to this file, implies --stats.",
+                                     ArgParseOption::OUTPUT_FILE));
+}
+
+// Parses a size in bytes suffixed by M or G.
+inline bool parse_size(uint64_t & bytes, std::string const & value)
+{
+    uint64_t base = std::stoi(value);
+    switch (value.at(value.size()-1))
+    {
+        case 'G': case 'g':
+            bytes = base * 1024*1024*1024;
+            return true;
+        case 'M': case 'm':
+            bytes = base * 1024*1024;
+            return true;
+        default:
+            return false;
+    }
 }
 
 ArgumentParser::ParseResult
@@ -126,80 +237,476 @@ parseCommandLine(Options & options, ArgumentParser & parser, int argc, char cons
         append(options.filter_file, "bloom.filter");
     }
 
+    getOptionValue(options.sample_table, parser, "sample-map");
+
     if (isSet(parser, "number-of-bins")) getOptionValue(options.number_of_bins, parser, "number-of-bins");
     if (isSet(parser, "kmer-size")) getOptionValue(options.kmer_size, parser, "kmer-size");
     if (isSet(parser, "window-size")) getOptionValue(options.window_size, parser, "window-size");
     if (isSet(parser, "threads")) getOptionValue(options.threads, parser, "threads");
     if (isSet(parser, "num-hash")) getOptionValue(options.number_of_hashes, parser, "num-hash");
+    if (isSet(parser, "shards")) getOptionValue(options.number_of_shards, parser, "shards");
+    if (isSet(parser, "hierarchy-bins")) getOptionValue(options.hierarchy_bins, parser, "hierarchy-bins");
+    getOptionValue(options.backend, parser, "backend");
+    std::string block_group;
+    if (getOptionValue(block_group, parser, "block-group"))
+        options.group_bytes = block_group == "page" ? 4096 : 64;
+    getOptionValue(options.fpr, parser, "fpr");
+    options.update = isSet(parser, "update");
+    getOptionValue(options.stats_file, parser, "stats-file");
+    options.stats = isSet(parser, "stats") || !empty(options.stats_file);
+    if (getOptionValue(options.tmp_dir, parser, "tmp-dir"))
+        append_trailing_slash(options.tmp_dir);
 
     std::string ibf_size;
     if (getOptionValue(ibf_size, parser, "bloom-size"))
     {
-        uint64_t base = std::stoi(ibf_size);
-        switch (ibf_size.at(ibf_size.size()-1))
+        if (!parse_size(options.size_of_ibf, ibf_size))
         {
-            case 'G': case 'g':
-                options.size_of_ibf =  base * 8*1024*1024*1024;
-                break;
-            case 'M': case 'm':
-                options.size_of_ibf =  base * 8*1024*1024;
-                break;
-            default:
-                std::cerr <<"[ERROR] invalid --bloom-size (-bs) parameter provided. (eg 256M, 1g)" << std::endl;
-                exit(1);
+            std::cerr <<"[ERROR] invalid --bloom-size (-bs) parameter provided. (eg 256M, 1g)" << std::endl;
+            exit(1);
         }
-
+        options.size_of_ibf *= 8;
+    }
+    std::string memory;
+    if (getOptionValue(memory, parser, "memory") && !parse_size(options.memory, memory))
+    {
+        std::cerr << "[ERROR] invalid --memory (-m) parameter provided. (eg 256M, 1g)" << std::endl;
+        return ArgumentParser::PARSE_ERROR;
+    }
+    if (options.memory != 0 && (options.hierarchy_bins != 0 || options.update))
+    {
+        std::cerr << "[ERROR] --memory cannot be combined with --hierarchy-bins or --update." << std::endl;
+        return ArgumentParser::PARSE_ERROR;
+    }
+    if (options.number_of_shards > (options.number_of_bins + 63ull) / 64)
+    {
+        std::cerr << "[ERROR] Shards span whole words of 64 bins, --shards can be at most "
+                  << (options.number_of_bins + 63ull) / 64 << "." << std::endl;
+        return ArgumentParser::PARSE_ERROR;
+    }
+    if (options.hierarchy_bins != 0 && (options.number_of_shards > 1 || options.update))
+    {
+        std::cerr << "[ERROR] --hierarchy-bins cannot be combined with --shards or --update." << std::endl;
+        return ArgumentParser::PARSE_ERROR;
+    }
+    if (isSet(parser, "fpr") && (options.fpr <= 0 || options.fpr >= 1))
+    {
+        std::cerr << "[ERROR] --fpr must be greater than 0 and less than 1." << std::endl;
+        return ArgumentParser::PARSE_ERROR;
+    }
+    if (options.fpr != 0 && (options.hierarchy_bins != 0 || options.update))
+    {
+        std::cerr << "[ERROR] --fpr cannot be combined with --hierarchy-bins or --update." << std::endl;
+        return ArgumentParser::PARSE_ERROR;
+    }
+    if (options.hierarchy_bins != 0 && options.backend == "direct")
+    {
+        std::cerr << "[ERROR] A hierarchical filter cannot use the direct backend." << std::endl;
+        return ArgumentParser::PARSE_ERROR;
     }
     return ArgumentParser::PARSE_OK;
 }
 
-template <typename TFilter>
-inline void build_filter(Options & options, TFilter & filter)
+template <typename THash, typename TBuilder>
+inline void fill_filter(Options const & options, TBuilder & filter, BinScheduler & scheduler, uint32_t first_bin,
+                        Stats & stats)
+{
+    std::vector<std::future<void>> tasks;
+
+    for (uint32_t task_number = 0; task_number < options.threads; ++task_number)
+    {
+        tasks.emplace_back(std::async([=, &scheduler, &filter, &stats] {
+            StatsRecorder recorder(stats);
+            typename TBuilder::Inserter inserter(filter);
+            THash hasher;
+            hasher.resize(filter.layout.kmer_size, filter.layout.window_size);
+            std::vector<uint64_t> kmer_hashes;
+            BinWork work;
+            while (scheduler.next(task_number, work))
+            {
+                read_work(work, [&] (RankView const & seq) {
+                    if(length(seq) < filter.layout.kmer_size)
+                        return;
+                    {
+                        StageTimer timer(&recorder, STAGE_HASH);
+                        hasher.getHash(seq, kmer_hashes);
+                        timer.add_items(kmer_hashes.size());
+                    }
+                    StageTimer timer(&recorder, STAGE_INSERT, kmer_hashes.size());
+                    for (uint64_t kmer_hash : kmer_hashes)
+                        inserter.insert(kmer_hash, work.bin_number - first_bin);
+                }, &recorder);
+            }
+            StageTimer timer(&recorder, STAGE_INSERT);
+            inserter.flush();
+        }));
+    }
+
+    for (auto &&task : tasks)
+    {
+        task.get();
+    }
+}
+
+inline void print_backend(IbfLayout const & layout)
+{
+    std::cerr << "Using the " << backend_name(layout.backend) << " backend";
+    if (layout.backend == BACKEND_BLOCKED)
+        std::cerr << " with " << layout.group_blocks << " blocks per group";
+    std::cerr << ", the filter takes " << (layout.words() * sizeof(uint64_t) >> 20) << " MiB." << std::endl;
+}
+
+// Estimates the number of distinct minimizers of every bin with a HyperLogLog sketch, in constant memory per work item.
+// Bins that were split into several work items merge their sketches once the last item is done.
+template <typename THash>
+inline std::vector<double> census(Options const & options, Stats & stats)
 {
     std::string com_ext = common_ext(options.contigs_dir, options.number_of_bins);
+    BinScheduler scheduler(options.contigs_dir, com_ext, 0, options.number_of_bins, options.threads);
 
-    uint32_t batch_size = options.number_of_bins/options.threads;
-    if(batch_size * options.threads < options.number_of_bins) ++batch_size;
+    std::vector<double> distinct(options.number_of_bins, 0);
+    std::vector<std::unique_ptr<HyperLogLog>> bin_sketches(options.number_of_bins);
+    std::vector<uint32_t> bin_chunks_done(options.number_of_bins, 0);
+    std::vector<std::mutex> bin_mtx(options.number_of_bins);
 
     std::vector<std::future<void>> tasks;
-
     for (uint32_t task_number = 0; task_number < options.threads; ++task_number)
     {
-        tasks.emplace_back(std::async([=, &filter] {
-            for (uint32_t bin_number = task_number*batch_size;
-                bin_number < options.number_of_bins && bin_number < (task_number +1) * batch_size;
-                ++bin_number)
+        tasks.emplace_back(std::async([=, &scheduler, &distinct, &bin_sketches, &bin_chunks_done, &bin_mtx, &stats] {
+            StatsRecorder recorder(stats);
+            THash hasher;
+            hasher.resize(options.kmer_size, options.window_size);
+            std::vector<uint64_t> kmer_hashes;
+            HyperLogLog sketch;
+            BinWork work;
+            while (scheduler.next(task_number, work))
             {
-                CharString seq_file_path;
-                append_file_name(seq_file_path, options.contigs_dir, bin_number);
-                append(seq_file_path, com_ext);
-
-                // read everything as CharString to avoid impure sequences crashing the program
-                CharString id;
-                Dna5String seq;
-                SeqFileIn seq_file_in;
-                if (!open(seq_file_in, toCString(seq_file_path)))
+                sketch.clear();
+                read_work(work, [&] (RankView const & seq) {
+                    if(length(seq) < options.kmer_size)
+                        return;
+                    {
+                        StageTimer timer(&recorder, STAGE_HASH);
+                        hasher.getHash(seq, kmer_hashes);
+                        timer.add_items(kmer_hashes.size());
+                    }
+                    StageTimer timer(&recorder, STAGE_INSERT, kmer_hashes.size());
+                    sketch.insert(kmer_hashes.begin(), kmer_hashes.end());
+                }, &recorder);
+
+                if (work.chunks > 1)
                 {
-                    CharString msg = "Unable to open contigs file: ";
-                    append(msg, CharString(seq_file_path));
-                    std::cerr << msg << std::endl;
-                    throw toCString(msg);
+                    std::lock_guard<std::mutex> lock(bin_mtx[work.bin_number]);
+                    std::unique_ptr<HyperLogLog> & bin_sketch = bin_sketches[work.bin_number];
+                    if (!bin_sketch)
+                        bin_sketch.reset(new HyperLogLog());
+                    bin_sketch->merge(sketch);
+                    if (++bin_chunks_done[work.bin_number] == work.chunks)
+                    {
+                        distinct[work.bin_number] = bin_sketch->estimate();
+                        bin_sketch.reset();
+                    }
+                    continue;
                 }
-                while(!atEnd(seq_file_in))
-                {
-                    readRecord(id, seq, seq_file_in);
+                distinct[work.bin_number] = sketch.estimate();
+            }
+        }));
+    }
+
+    for (auto &&task : tasks)
+    {
+        task.get();
+    }
+    return distinct;
+}
+
+// The layout of the filter over the given bins: sized by fpr_layout() for the largest of them if --fpr is given, from
+// --bloom-size and --num-hash otherwise. Reports the size before anything is allocated.
+inline IbfLayout filter_layout(Options const & options, std::vector<double> const & distinct, uint32_t first_bin,
+                               uint32_t number_of_bins, uint64_t bits)
+{
+    uint64_t const group_blocks = IbfLayout::default_group_blocks((number_of_bins + 63) / 64, options.group_bytes);
+    if (options.fpr == 0)
+    {
+        uint64_t backend = choose_backend(options.backend, number_of_bins, options.kmer_size, bits);
+        // The metadata has to start at a word boundary.
+        return IbfLayout(number_of_bins, options.number_of_hashes, options.kmer_size, options.window_size,
+                         backend == BACKEND_DIRECT ? direct_filter_bits(number_of_bins, options.kmer_size) :
+                                                     bits - bits % 64,
+                         backend, group_blocks);
+    }
+
+    double elements = *std::max_element(distinct.begin() + first_bin, distinct.begin() + first_bin + number_of_bins);
+    // The sketch is off by 0.8% on average, 2.5% covers about three standard errors.
+    IbfLayout layout = fpr_layout(options.backend, number_of_bins, options.kmer_size, options.window_size,
+                                  options.group_bytes, elements * 1.025, options.fpr);
+    std::cerr << "The largest of bins " << first_bin << " to " << first_bin + number_of_bins - 1 << " has about "
+              << static_cast<uint64_t>(elements) << " distinct minimizers, " << layout.number_of_hashes
+              << " hash functions and " << (layout.words() * sizeof(uint64_t) >> 20) << " MiB reach a false positive "
+              << "rate of " << false_positive_rate(layout, elements) << "." << std::endl;
+    return layout;
+}
+
+template <typename THash, typename TBuilder>
+inline void fill_and_store(Options & options, TBuilder & filter, uint32_t first_bin, CharString const & filter_file,
+                           Stats & stats)
+{
+    std::string com_ext = common_ext(options.contigs_dir, options.number_of_bins);
+
+    BinScheduler scheduler(options.contigs_dir, com_ext, first_bin, filter.layout.number_of_bins, options.threads);
+    fill_filter<THash>(options, filter, scheduler, first_bin, stats);
+
+    StatsRecorder recorder(stats);
+    StageTimer timer(&recorder, STAGE_WRITE, filter.layout.words() * sizeof(uint64_t));
+    store(filter, filter_file);
+}
+
+// Builds the filter of the layout over the bins from first_bin on, out of core if it is larger than --memory.
+template <typename THash>
+inline void build_filter(Options & options, IbfLayout const & layout, uint32_t first_bin,
+                         CharString const & filter_file, Stats & stats)
+{
+    if (options.memory == 0 || layout.words() * sizeof(uint64_t) <= options.memory)
+    {
+        IbfBuilder filter(layout.number_of_bins,
+                          layout.number_of_hashes,
+                          layout.kmer_size,
+                          layout.window_size,
+                          layout.bits,
+                          options.threads,
+                          layout.backend,
+                          layout.group_blocks);
+        print_backend(filter.layout);
+        fill_and_store<THash>(options, filter, first_bin, filter_file, stats);
+        return;
+    }
+
+    CharString tmp_prefix = filter_file;
+    if (!empty(options.tmp_dir))
+    {
+        std::string file = toCString(filter_file);
+        tmp_prefix = options.tmp_dir;
+        append(tmp_prefix, file.substr(file.find_last_of('/') + 1));
+    }
+    ExternalIbfBuilder filter(layout, options.memory, tmp_prefix, options.threads);
+    print_backend(filter.layout);
+    std::cerr << "The filter is larger than --memory, it is built out of core in " << filter.regions()
+              << " regions." << std::endl;
+    fill_and_store<THash>(options, filter, first_bin, filter_file, stats);
+    std::cerr << "The sorted runs took " << (filter.run_bytes() >> 20) << " MiB." << std::endl;
+}
+
+// Builds a hierarchical filter over the bins of options.contigs_dir. The top level and all lower levels are filled in
+// one pass over the bin files: the minimizers of a merged bin go into its technical bin of the top level and into its
+// own bin of the lower level. A lower level gets as many blocks, relative to the top level, as its largest bin is large
+// relative to the largest technical bin.
+template <typename THash>
+inline void build_hierarchy(Options & options, Stats & stats)
+{
+    std::string com_ext = common_ext(options.contigs_dir, options.number_of_bins);
+    auto files = BinScheduler::bin_files(options.contigs_dir, com_ext, 0, options.number_of_bins);
+    std::vector<uint64_t> sizes(files.size(), 0);
+    for (size_t file = 0; file < files.size(); ++file)
+    {
+        struct stat st;
+        if (stat(toCString(files[file].second), &st) == 0)
+            sizes[file] = st.st_size;
+    }
+
+    HierarchyManifest manifest;
+    hierarchy_layout(manifest, options.filter_file, sizes, options.hierarchy_bins);
+
+    // Lower levels are sized in blocks of the top level, which direct-addressed filters do not have, so auto is ibf.
+    uint64_t const backend = options.backend == "blocked" ? BACKEND_BLOCKED : BACKEND_IBF;
+    IbfBuilder top_level(manifest.technical_bins.size(),
+                         options.number_of_hashes,
+                         options.kmer_size,
+                         options.window_size,
+                         options.size_of_ibf,
+                         options.threads,
+                         backend,
+                         IbfLayout::default_group_blocks((manifest.technical_bins.size() + 63) / 64,
+                                                         options.group_bytes));
+    print_backend(top_level.layout);
+
+    // technical_bins[b] and lower_bins[b] are the technical bin and the bin of its lower level of user bin b.
+    std::vector<uint32_t> technical_bins(options.number_of_bins);
+    std::vector<uint32_t> lower_bins(options.number_of_bins);
+    std::vector<uint64_t> loads(manifest.technical_bins.size(), 0);
+    for (uint32_t t = 0; t < manifest.technical_bins.size(); ++t)
+    {
+        std::vector<uint32_t> const & user_bins = manifest.technical_bins[t].user_bins;
+        for (uint32_t i = 0; i < user_bins.size(); ++i)
+        {
+            technical_bins[user_bins[i]] = t;
+            lower_bins[user_bins[i]] = i;
+            loads[t] += sizes[user_bins[i]];
+        }
+    }
+    uint64_t max_load = std::max<uint64_t>(1, *std::max_element(loads.begin(), loads.end()));
+
+    std::vector<std::unique_ptr<IbfBuilder>> lower_levels(manifest.technical_bins.size());
+    uint64_t total_words = top_level.words.size();
+    for (uint32_t t = 0; t < manifest.technical_bins.size(); ++t)
+    {
+        std::vector<uint32_t> const & user_bins = manifest.technical_bins[t].user_bins;
+        if (user_bins.size() == 1)
+            continue;
+        // User bins are ordered by size, the first one is the largest.
+        uint64_t blocks = (static_cast<unsigned __int128>(top_level.layout.blocks) * sizes[user_bins[0]] + max_load - 1)
+                          / max_load;
+        uint64_t bin_width = (user_bins.size() + 63) / 64;
+        uint64_t group_blocks = IbfLayout::default_group_blocks(bin_width, options.group_bytes);
+        // The blocked backend needs at least one whole group.
+        if (backend == BACKEND_BLOCKED)
+            blocks = (std::max<uint64_t>(blocks, 1) + group_blocks - 1) / group_blocks * group_blocks;
+        lower_levels[t].reset(new IbfBuilder(user_bins.size(),
+                                             options.number_of_hashes,
+                                             options.kmer_size,
+                                             options.window_size,
+                                             std::max<uint64_t>(blocks, 1) * 64 * bin_width,
+                                             options.threads,
+                                             backend,
+                                             group_blocks));
+        total_words += lower_levels[t]->words.size();
+    }
+    std::cerr << "Merged " << options.number_of_bins << " bins into " << manifest.technical_bins.size()
+              << " technical bins, " << std::count_if(lower_levels.begin(), lower_levels.end(),
+                 [] (std::unique_ptr<IbfBuilder> const & lower_level) { return static_cast<bool>(lower_level); })
+              << " of them with a lower level. All filters take " << (total_words * sizeof(uint64_t) >> 20)
+              << " MiB." << std::endl;
+
+    BinScheduler scheduler(files, options.threads);
+    std::vector<std::future<void>> tasks;
+    for (uint32_t task_number = 0; task_number < options.threads; ++task_number)
+    {
+        tasks.emplace_back(std::async([=, &scheduler, &top_level, &lower_levels, &technical_bins, &lower_bins,
+                                       &stats] {
+            StatsRecorder recorder(stats);
+            IbfBuilder::Inserter inserter(top_level);
+            THash hasher;
+            hasher.resize(options.kmer_size, options.window_size);
+            std::vector<uint64_t> kmer_hashes;
+            BinWork work;
+            while (scheduler.next(task_number, work))
+            {
+                uint32_t technical_bin = technical_bins[work.bin_number];
+                uint32_t lower_bin = lower_bins[work.bin_number];
+                // Most lower levels are only touched by a few work items, their buffers are applied after every one.
+                std::unique_ptr<IbfBuilder::Inserter> lower_inserter;
+                if (lower_levels[technical_bin])
+                    lower_inserter.reset(new IbfBuilder::Inserter(*lower_levels[technical_bin]));
+                read_work(work, [&] (RankView const & seq) {
                     if(length(seq) < options.kmer_size)
-                        continue;
-                    insertKmer(filter, seq, bin_number);
-                }
-            }}));
+                        return;
+                    {
+                        StageTimer timer(&recorder, STAGE_HASH);
+                        hasher.getHash(seq, kmer_hashes);
+                        timer.add_items(kmer_hashes.size());
+                    }
+                    StageTimer timer(&recorder, STAGE_INSERT, kmer_hashes.size());
+                    for (uint64_t kmer_hash : kmer_hashes)
+                        inserter.insert(kmer_hash, technical_bin);
+                    if (lower_inserter)
+                    {
+                        for (uint64_t kmer_hash : kmer_hashes)
+                            lower_inserter->insert(kmer_hash, lower_bin);
+                    }
+                }, &recorder);
+                StageTimer timer(&recorder, STAGE_INSERT);
+                lower_inserter.reset();
+            }
+            StageTimer timer(&recorder, STAGE_INSERT);
+            inserter.flush();
+        }));
     }
 
     for (auto &&task : tasks)
     {
         task.get();
     }
-    store(filter, toCString(options.filter_file));
+
+    StatsRecorder recorder(stats);
+    StageTimer timer(&recorder, STAGE_WRITE, total_words * sizeof(uint64_t));
+    store(top_level, manifest.top_level_file);
+    for (uint32_t t = 0; t < manifest.technical_bins.size(); ++t)
+    {
+        if (lower_levels[t])
+            store(*lower_levels[t], manifest.technical_bins[t].file_name);
+    }
+    store(manifest, options.filter_file);
+}
+
+// Inserts the bin files of options.contigs_dir into the existing filter options.filter_file. Files are named by
+// their bin number. Bins that exist already are cleared first, bins beyond the current number of bins are added.
+inline void update_filter(Options & options, SampleMap & samples, Stats & stats)
+{
+    if (is_shard_manifest(options.filter_file))
+        throw RuntimeError("Updating a sharded filter is not supported.");
+    if (is_hierarchy_manifest(options.filter_file))
+        throw RuntimeError("Updating a hierarchical filter is not supported.");
+
+    IbfBuilder filter(options.filter_file, options.threads);
+    uint64_t old_number_of_bins = filter.layout.number_of_bins;
+
+    StringSet<CharString> file_names;
+    get_valid_files_in_dir(file_names, options.contigs_dir, SeqFileIn::getFileExtensions());
+
+    std::vector<std::pair<uint32_t, CharString>> files;
+    std::vector<uint32_t> replaced_bins;
+    uint64_t number_of_bins = old_number_of_bins;
+    for (uint32_t i = 0; i < length(file_names); ++i)
+    {
+        uint32_t bin_number;
+        if (!get_bin_number_from_file(bin_number, file_names[i]))
+        {
+            std::cerr << "Skipping " << file_names[i] << ", its name is not a bin number." << std::endl;
+            continue;
+        }
+        CharString file_path = options.contigs_dir;
+        append(file_path, file_names[i]);
+        files.emplace_back(bin_number, file_path);
+        if (bin_number < old_number_of_bins)
+            replaced_bins.push_back(bin_number);
+        number_of_bins = std::max<uint64_t>(number_of_bins, bin_number + 1);
+    }
+
+    CharString sample_map_file = options.filter_file;
+    append(sample_map_file, ".samples");
+    if (!empty(options.sample_table))
+    {
+        read_sample_table(samples, options.sample_table, number_of_bins);
+    }
+    else if (number_of_bins > old_number_of_bins && retrieve(samples, sample_map_file))
+    {
+        throw RuntimeError("The filter has a sample map, new bins need an updated one (--sample-map).");
+    }
+
+    if (filter.layout.window_size == 0)
+        filter.layout.window_size = options.window_size;
+    filter.resize_bins(number_of_bins);
+    filter.clear_bins(replaced_bins);
+
+    std::cerr << "Replacing " << replaced_bins.size() << " and adding " << number_of_bins - old_number_of_bins
+              << " bins." << std::endl;
+
+    dispatch_minimizer(filter.layout.kmer_size, filter.layout.window_size, [&] (auto tag) {
+        BinScheduler scheduler(files, options.threads);
+        fill_filter<MinimizerHash<Dna5, typename decltype(tag)::Type>>(options, filter, scheduler, 0, stats);
+    });
+
+    // Replace the filter only once the new one is complete.
+    CharString tmp_file = options.filter_file;
+    append(tmp_file, ".tmp");
+    {
+        StatsRecorder recorder(stats);
+        StageTimer timer(&recorder, STAGE_WRITE, filter.words.size() * sizeof(uint64_t));
+        store(filter, tmp_file);
+    }
+    if (std::rename(toCString(tmp_file), toCString(options.filter_file)) != 0)
+        throw IOError("Unable to replace filter file: " + std::string(toCString(options.filter_file)));
+    if (!empty(options.sample_table))
+        store(samples, sample_map_file);
 }
 
 int main(int argc, char const ** argv)
@@ -214,19 +721,60 @@ int main(int argc, char const ** argv)
         return res == ArgumentParser::PARSE_ERROR;
 
     // check if file already exists or can be created
-    if (!check_output_file(options.filter_file))
+    if (!options.update && !check_output_file(options.filter_file))
         return 1;
 
     try
     {
-        typedef BDConfig<Dna5, Minimizer<19, 24>, Uncompressed> Config;
-        BinningDirectory<InterleavedBloomFilter, Config> filter(options.number_of_bins,
-                                                                options.number_of_hashes,
-                                                                options.kmer_size,
-                                                                options.size_of_ibf);
-        filter.kmerSize = options.kmer_size;
-        filter.windowSize = options.window_size;
-        build_filter(options, filter);
+        SampleMap samples;
+        Stats stats(options.stats);
+        if (options.update)
+        {
+            update_filter(options, samples, stats);
+            report_stats(stats, options.stats_file);
+            return 0;
+        }
+
+        if (!empty(options.sample_table))
+            read_sample_table(samples, options.sample_table, options.number_of_bins);
+
+        dispatch_minimizer(options.kmer_size, options.window_size, [&] (auto tag) {
+            typedef MinimizerHash<Dna5, typename decltype(tag)::Type> THash;
+            if (options.hierarchy_bins != 0)
+            {
+                build_hierarchy<THash>(options, stats);
+                return;
+            }
+            std::vector<double> distinct;
+            if (options.fpr != 0)
+                distinct = census<THash>(options, stats);
+            if (options.number_of_shards <= 1)
+            {
+                IbfLayout layout = filter_layout(options, distinct, 0, options.number_of_bins, options.size_of_ibf);
+                build_filter<THash>(options, layout, 0, options.filter_file, stats);
+                return;
+            }
+
+            // Every shard gets the same number of blocks as an unsharded filter, only fewer words per block.
+            ShardManifest manifest;
+            shard_manifest(manifest, options.filter_file, options.number_of_bins, options.number_of_shards);
+            uint64_t bits_per_word = options.size_of_ibf / ((options.number_of_bins + 63) / 64);
+            for (auto const & shard : manifest.shards)
+            {
+                IbfLayout layout = filter_layout(options, distinct, shard.first_bin, shard.number_of_bins,
+                                                 bits_per_word * ((shard.number_of_bins + 63) / 64));
+                build_filter<THash>(options, layout, shard.first_bin, shard.file_name, stats);
+            }
+            store(manifest, options.filter_file);
+        });
+
+        if (!empty(options.sample_table))
+        {
+            CharString sample_map_file = options.filter_file;
+            append(sample_map_file, ".samples");
+            store(samples, sample_map_file);
+        }
+        report_stats(stats, options.stats_file);
     }
     catch (Exception const & e)
     {
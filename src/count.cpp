@@ -32,12 +32,17 @@
 // Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
 // ==========================================================================
 
-#include <unordered_set>
+#include <atomic>
+#include <sstream>
 
 #include <seqan/arg_parse.h>
 #include <seqan/binning_directory.h>
 
 #include "helper.h"
+#include "dispatch.h"
+#include "hyperloglog.h"
+#include "kmer_set.h"
+#include "minimizer.h"
 
 using namespace seqan;
 
@@ -45,17 +50,26 @@ struct Options
 {
     CharString  contigs_dir;
     CharString  output_file;
+    CharString  stats_file;
 
     uint32_t    kmer_size;
     uint32_t    window_size;
     uint32_t    number_of_bins;
+    uint32_t    sketch_precision;
     unsigned    threads;
+    bool        sketch;
+    bool        overlaps;
+    bool        stats;
 
     Options():
         kmer_size(19),
         window_size(23),
         number_of_bins(64),
-        threads(1) {}
+        sketch_precision(14),
+        threads(1),
+        sketch(false),
+        overlaps(false),
+        stats(false) {}
 };
 
 void setupArgumentParser(ArgumentParser & parser, Options const & options)
@@ -88,6 +102,24 @@ void setupArgumentParser(ArgumentParser & parser, Options const & options)
     addOption(parser, ArgParseOption("w", "window-size", "The size of the window to count",
                                      ArgParseOption::INTEGER));
     setMinValue(parser, "window-size", "14");
+
+    addOption(parser, ArgParseOption("", "sketch", "Estimate the counts with a HyperLogLog sketch of \
+                                     2^--sketch-precision bytes per bin instead of counting exactly. The overall count \
+                                     is estimated from the merged sketches, which works for every k-mer size."));
+    addOption(parser, ArgParseOption("", "sketch-precision", "The relative error of a sketch is about \
+                                     1.04 / sqrt(2^precision).", ArgParseOption::INTEGER));
+    setMinValue(parser, "sketch-precision", "4");
+    setMaxValue(parser, "sketch-precision", "18");
+    setDefaultValue(parser, "sketch-precision", options.sketch_precision);
+    addOption(parser, ArgParseOption("", "overlaps", "Also estimate the minimizers that every pair of bins shares \
+                                     and write them to --output-file (bin, bin, shared minimizers, Jaccard index). \
+                                     The estimate is the difference of the bins and their union, overlaps below the \
+                                     error of the union are noise. Implies --sketch."));
+
+    addOption(parser, ArgParseOption("", "stats", "Print the time spent per stage (read, hash, insert) and the \
+                                     hardware counters of the worker threads."));
+    addOption(parser, ArgParseOption("", "stats-file", "Write the stats as JSON to this file, implies --stats.",
+                                     ArgParseOption::OUTPUT_FILE));
 }
 
 ArgumentParser::ParseResult
@@ -116,69 +148,193 @@ parseCommandLine(Options & options, ArgumentParser & parser, int argc, char cons
     if (isSet(parser, "kmer-size")) getOptionValue(options.kmer_size, parser, "kmer-size");
     if (isSet(parser, "window-size")) getOptionValue(options.window_size, parser, "window-size");
     if (isSet(parser, "threads")) getOptionValue(options.threads, parser, "threads");
+    getOptionValue(options.sketch_precision, parser, "sketch-precision");
+    options.overlaps = isSet(parser, "overlaps");
+    options.sketch = isSet(parser, "sketch") || options.overlaps;
+    getOptionValue(options.stats_file, parser, "stats-file");
+    options.stats = isSet(parser, "stats") || !empty(options.stats_file);
+
+    // The exact overall count needs a bit for every k-mer.
+    if (!options.sketch && options.kmer_size == 32)
+    {
+        std::cerr << "[ERROR] Counting exactly needs 4^k bits, use --sketch for k = 32." << std::endl;
+        return ArgumentParser::PARSE_ERROR;
+    }
 
     return ArgumentParser::PARSE_OK;
 }
 
+template <typename TMinimizer>
 inline void count_kmers(Options & options)
 {
     std::string com_ext = common_ext(options.contigs_dir, options.number_of_bins);
 
-    uint32_t batch_size = options.number_of_bins/options.threads;
-    if(batch_size * options.threads < options.number_of_bins) ++batch_size;
+    BinScheduler scheduler(options.contigs_dir, com_ext, 0, options.number_of_bins, options.threads);
 
     std::vector<std::future<void>> tasks;
 
     std::mutex print_mtx;
-    std::mutex set_mtx;
 
     uint64_t bv_size = 1ULL<<(2*options.kmer_size);
     uint64_t sig_bit = bv_size - 1;
 
-    sdsl::bit_vector overall_content(bv_size, 0, 1);
+    // Every thread sets the bits of its bins directly, the bits are set atomically.
+    ConcurrentBitVector overall_content(bv_size);
+
+    // Bins that were split into several work items collect their hashes here until the last item is done.
+    std::vector<KmerSet> bin_hashes(options.number_of_bins, KmerSet(0));
+    std::vector<uint32_t> bin_chunks_done(options.number_of_bins, 0);
+    std::vector<std::mutex> bin_mtx(options.number_of_bins);
+    Stats stats(options.stats);
 
     for (uint32_t task_number = 0; task_number < options.threads; ++task_number)
     {
-        tasks.emplace_back(std::async([=, &print_mtx, &set_mtx, &overall_content] {
-            for (uint32_t bin_number = task_number*batch_size;
-                bin_number < options.number_of_bins && bin_number < (task_number +1) * batch_size;
-                ++bin_number)
+        tasks.emplace_back(std::async([=, &scheduler, &print_mtx, &overall_content,
+                                          &bin_hashes, &bin_chunks_done, &bin_mtx, &stats] {
+            StatsRecorder recorder(stats);
+            BinWork work;
+            while (scheduler.next(task_number, work))
             {
-                CharString seq_file_path;
-                append_file_name(seq_file_path, options.contigs_dir, bin_number);
-                append(seq_file_path, com_ext);
-
-                // read everything as CharString to avoid impure sequences crashing the program
-                Dna5String seq;
-                CharString id;
-                SeqFileIn seq_file_in;
-                if (!open(seq_file_in, toCString(seq_file_path)))
+                KmerSet hashes;
+                MinimizerHash<Dna5, TMinimizer> minimizer;
+                minimizer.resize(options.kmer_size, options.window_size);
+                std::vector<uint64_t> mins;
+                read_work(work, [&] (RankView const & seq) {
+                    if(length(seq) < options.kmer_size)
+                        return;
+                    {
+                        StageTimer timer(&recorder, STAGE_HASH);
+                        minimizer.getHash(seq, mins);
+                        timer.add_items(mins.size());
+                    }
+                    StageTimer timer(&recorder, STAGE_INSERT, mins.size());
+                    hashes.insert(mins.begin(), mins.end());
+                }, &recorder);
+
+                if (work.chunks > 1)
                 {
-                    CharString msg = "Unable to open contigs file: ";
-                    append(msg, CharString(seq_file_path));
-                    std::cerr << msg << std::endl;
-                    throw toCString(msg);
+                    std::lock_guard<std::mutex> lock(bin_mtx[work.bin_number]);
+                    KmerSet & bin_set = bin_hashes[work.bin_number];
+                    hashes.for_each([&bin_set] (uint64_t x) { bin_set.insert(x); });
+                    if (++bin_chunks_done[work.bin_number] < work.chunks)
+                        continue;
+                    hashes.swap(bin_set);
+                    bin_set.clear();
                 }
-                std::unordered_set<uint64_t> hashes;
-                while(!atEnd(seq_file_in))
+
+                print_mtx.lock();
+                std::cerr << work.bin_number << '\t' << hashes.size() << std::endl;
+                print_mtx.unlock();
+                hashes.for_each([&] (uint64_t x) {
+                    overall_content.set(x & sig_bit);
+                });
+            }}));
+    }
+
+    for (auto &&task : tasks)
+    {
+        task.get();
+    }
+    std::cerr << "Overall" << '\t' << overall_content.count() << std::endl;
+    report_stats(stats, options.stats_file);
+}
+
+// Estimates the shared minimizers of all pairs of bins by inclusion-exclusion, |A| + |B| - |A u B|. The pairs are
+// computed by all threads in batches of rows and written in order.
+inline void write_overlaps(Options const & options, std::vector<HyperLogLog> const & bin_sketches,
+                           std::vector<double> const & estimates)
+{
+    std::ofstream out(toCString(options.output_file));
+    uint32_t const batch_rows = 64 * options.threads;
+    std::vector<std::string> rows(batch_rows);
+    for (uint32_t first_row = 0; first_row < options.number_of_bins; first_row += batch_rows)
+    {
+        uint32_t last_row = std::min(first_row + batch_rows, options.number_of_bins);
+        std::atomic<uint32_t> next_row{first_row};
+        std::vector<std::future<void>> tasks;
+        for (uint32_t task_number = 0; task_number < options.threads; ++task_number)
+        {
+            tasks.emplace_back(std::async([&] {
+                for (uint32_t a = next_row++; a < last_row; a = next_row++)
                 {
-                    BDHash<Dna5, Minimizer<19,25>> minimizer;
-                    minimizer.resize(options.kmer_size, options.window_size);
-                    readRecord(id, seq, seq_file_in);
+                    std::ostringstream row;
+                    for (uint32_t b = a + 1; b < options.number_of_bins; ++b)
+                    {
+                        double all = bin_sketches[a].union_estimate(bin_sketches[b]);
+                        double shared = std::max(0.0, estimates[a] + estimates[b] - all);
+                        row << a << '\t' << b << '\t' << static_cast<uint64_t>(shared) << '\t'
+                            << (all > 0 ? shared / all : 0) << '\n';
+                    }
+                    rows[a - first_row] = row.str();
+                }
+            }));
+        }
+        for (auto &&task : tasks)
+        {
+            task.get();
+        }
+        for (uint32_t a = first_row; a < last_row; ++a)
+            out << rows[a - first_row];
+    }
+    if (!out)
+        throw IOError("Unable to write overlaps: " + std::string(toCString(options.output_file)));
+}
+
+// Like count_kmers(), but every bin only keeps a HyperLogLog sketch. Bins that were split into several work items
+// merge the sketches of their items, the overall count is estimated from the union of all sketches.
+template <typename TMinimizer>
+inline void sketch_kmers(Options & options)
+{
+    std::string com_ext = common_ext(options.contigs_dir, options.number_of_bins);
+
+    BinScheduler scheduler(options.contigs_dir, com_ext, 0, options.number_of_bins, options.threads);
+
+    std::vector<std::future<void>> tasks;
+
+    std::mutex print_mtx;
+
+    std::vector<HyperLogLog> bin_sketches(options.number_of_bins, HyperLogLog(options.sketch_precision));
+    std::vector<std::mutex> bin_mtx(options.number_of_bins);
+    std::vector<uint32_t> bin_chunks_done(options.number_of_bins, 0);
+    std::vector<double> estimates(options.number_of_bins, 0);
+    Stats stats(options.stats);
+
+    for (uint32_t task_number = 0; task_number < options.threads; ++task_number)
+    {
+        tasks.emplace_back(std::async([=, &scheduler, &print_mtx, &bin_sketches, &bin_mtx, &bin_chunks_done,
+                                          &estimates, &stats] {
+            StatsRecorder recorder(stats);
+            MinimizerHash<Dna5, TMinimizer> minimizer;
+            minimizer.resize(options.kmer_size, options.window_size);
+            std::vector<uint64_t> mins;
+            HyperLogLog sketch(options.sketch_precision);
+            BinWork work;
+            while (scheduler.next(task_number, work))
+            {
+                sketch.clear();
+                read_work(work, [&] (RankView const & seq) {
                     if(length(seq) < options.kmer_size)
+                        return;
+                    {
+                        StageTimer timer(&recorder, STAGE_HASH);
+                        minimizer.getHash(seq, mins);
+                        timer.add_items(mins.size());
+                    }
+                    StageTimer timer(&recorder, STAGE_INSERT, mins.size());
+                    sketch.insert(mins.begin(), mins.end());
+                }, &recorder);
+
+                {
+                    std::lock_guard<std::mutex> lock(bin_mtx[work.bin_number]);
+                    bin_sketches[work.bin_number].merge(sketch);
+                    if (++bin_chunks_done[work.bin_number] < work.chunks)
                         continue;
-                    auto mins = minimizer.getHash(seq);
-                    hashes.insert(mins.begin(), mins.end());
+                    estimates[work.bin_number] = bin_sketches[work.bin_number].estimate();
                 }
+
                 print_mtx.lock();
-                std::cerr << bin_number << '\t' << hashes.size() << std::endl;
+                std::cerr << work.bin_number << '\t' << static_cast<uint64_t>(estimates[work.bin_number]) << std::endl;
                 print_mtx.unlock();
-                // set_mtx.lock();
-                for (auto &x : hashes)
-                {
-                    overall_content[(x & sig_bit)] = 1;
-                }
-                // set_mtx.unlock();
             }}));
     }
 
@@ -186,12 +342,15 @@ inline void count_kmers(Options & options)
     {
         task.get();
     }
-    uint64_t overall_count{0};
-    for (uint64_t idx = 0; idx < bv_size; idx+=64)
-    {
-        overall_count += sdsl::bits::cnt(overall_content.get_int(idx));
-    }
-    std::cerr << "Overall" << '\t' << overall_count << std::endl;
+
+    HyperLogLog overall_content(options.sketch_precision);
+    for (HyperLogLog const & bin_sketch : bin_sketches)
+        overall_content.merge(bin_sketch);
+    std::cerr << "Overall" << '\t' << static_cast<uint64_t>(overall_content.estimate()) << std::endl;
+
+    if (options.overlaps)
+        write_overlaps(options, bin_sketches, estimates);
+    report_stats(stats, options.stats_file);
 }
 
 int main(int argc, char const ** argv)
@@ -211,7 +370,12 @@ int main(int argc, char const ** argv)
 
     try
     {
-        count_kmers(options);
+        dispatch_minimizer(options.kmer_size, options.window_size, [&] (auto tag) {
+            if (options.sketch)
+                sketch_kmers<typename decltype(tag)::Type>(options);
+            else
+                count_kmers<typename decltype(tag)::Type>(options);
+        });
     }
     catch (Exception const & e)
     {
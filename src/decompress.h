@@ -0,0 +1,367 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#ifndef SRA_SEARCH_DECOMPRESS_H_
+#define SRA_SEARCH_DECOMPRESS_H_
+
+#if SEQAN_HAS_ZLIB
+
+#include <zlib.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <string>
+#include <vector>
+
+#include <seqan/basic.h>
+#include <seqan/sequence.h>
+
+#include "block_source.h"
+#include "pipeline.h"
+
+using namespace seqan;
+
+// ----------------------------------------------------------------------------
+// Function bgzf_block_size()
+// ----------------------------------------------------------------------------
+// Size of the BGZF block starting at data, taken from its BC extra field.
+// Returns 0 if the header is not complete within available bytes and throws
+// if data does not start with a BGZF header.
+
+inline size_t bgzf_block_size(unsigned char const * data, size_t available)
+{
+    if (available < 12)
+        return 0;
+    if (data[0] != 0x1f || data[1] != 0x8b || data[2] != 8 || !(data[3] & 4))
+        throw ParseError("Invalid BGZF block header.");
+    size_t extra_length = data[10] | data[11] << 8;
+    if (available < 12 + extra_length)
+        return 0;
+    for (size_t i = 12; i + 4 <= 12 + extra_length;)
+    {
+        size_t field_length = data[i + 2] | data[i + 3] << 8;
+        if (data[i] == 'B' && data[i + 1] == 'C' && field_length == 2)
+            return (data[i + 4] | data[i + 5] << 8) + 1;
+        i += 4 + field_length;
+    }
+    throw ParseError("Invalid BGZF block header.");
+}
+
+// ----------------------------------------------------------------------------
+// Function is_bgzf_file()
+// ----------------------------------------------------------------------------
+
+inline bool is_bgzf_file(CharString const & file_name)
+{
+    unsigned char header[18];
+    FileSource file(file_name);
+    size_t bytes = 0, read;
+    while (bytes < sizeof(header) && (read = file.read(reinterpret_cast<char *>(header) + bytes, sizeof(header) - bytes)))
+        bytes += read;
+    return bytes == sizeof(header) && header[0] == 0x1f && header[1] == 0x8b && (header[3] & 4) &&
+           header[12] == 'B' && header[13] == 'C';
+}
+
+// ----------------------------------------------------------------------------
+// Class InflateSource
+// ----------------------------------------------------------------------------
+// Decompresses a gzip file on separate threads, so a FastxReader parses the
+// output while the next blocks are inflated.
+//
+// BGZF files consist of independent deflate blocks of at most 64 KiB, whose
+// sizes are stored in the gzip headers. One thread reads batches of whole
+// blocks, up to `threads` threads inflate the batches, and read() returns them
+// in file order. Plain gzip streams can only be inflated sequentially, which
+// is done by a single thread; concatenated members are supported.
+
+class InflateSource : public BlockSource
+{
+public:
+    InflateSource(CharString const & file_name, unsigned threads = 1) :
+        file(file_name),
+        compressed(threads ? threads : 1),
+        inflated((threads ? threads : 1) + 2),
+        active(0),
+        position(0)
+    {
+        if (!is_bgzf_file(file_name))
+        {
+            reader = std::async(std::launch::async, [this] { run(&InflateSource::inflate_stream); });
+            return;
+        }
+
+        active = threads ? threads : 1;
+        reader = std::async(std::launch::async, [this] { run(&InflateSource::read_batches); });
+        for (unsigned i = 0; i < active; ++i)
+            inflaters.push_back(std::async(std::launch::async, [this] { run(&InflateSource::inflate_batches); }));
+    }
+
+    ~InflateSource()
+    {
+        compressed.close();
+        inflated.close();
+        try
+        {
+            finish();
+        }
+        catch (...) {}
+    }
+
+    size_t read(char * buffer, size_t size) override
+    {
+        while (position == current.size())
+        {
+            position = 0;
+            if (!inflated.pop(current))
+            {
+                current.clear();
+                finish();
+                return 0;
+            }
+        }
+        size_t bytes = std::min(size, current.size() - position);
+        std::memcpy(buffer, current.data() + position, bytes);
+        position += bytes;
+        return bytes;
+    }
+
+private:
+    static const size_t batch_size{1ULL << 20};
+    static const size_t chunk_size{4ULL << 20};
+
+    struct Batch
+    {
+        uint64_t    number;
+        std::string data;
+    };
+
+    FileSource                      file;
+    ConcurrentQueue<Batch>          compressed;
+    OrderedQueue<std::string>       inflated;
+    std::future<void>               reader;
+    std::vector<std::future<void>>  inflaters;
+    std::atomic<unsigned>           active;
+    std::string                     current;
+    size_t                          position;
+
+    // Closes the queues if a stage fails, so that no other stage waits forever.
+    void run(void (InflateSource::*stage)())
+    {
+        try
+        {
+            (this->*stage)();
+        }
+        catch (...)
+        {
+            compressed.close();
+            inflated.close();
+            throw;
+        }
+    }
+
+    // Waits for all stages and rethrows the first error.
+    void finish()
+    {
+        if (reader.valid())
+            reader.get();
+        for (auto & inflater : inflaters)
+        {
+            if (inflater.valid())
+                inflater.get();
+        }
+    }
+
+    // Splits the file into batches of whole BGZF blocks.
+    void read_batches()
+    {
+        std::string data;
+        uint64_t number = 0;
+        bool at_end = false;
+        while (!at_end)
+        {
+            size_t filled = data.size();
+            data.resize(filled + batch_size);
+            size_t bytes = file.read(&data[0] + filled, batch_size);
+            data.resize(filled + bytes);
+            at_end = bytes == 0;
+
+            auto blocks = reinterpret_cast<unsigned char const *>(data.data());
+            size_t end = 0, block_size;
+            while ((block_size = bgzf_block_size(blocks + end, data.size() - end)) && end + block_size <= data.size())
+                end += block_size;
+            if (at_end && end != data.size())
+                throw IOError("Truncated BGZF file.");
+            if (end < batch_size && !at_end)
+                continue;
+
+            std::string rest(data, end);
+            data.resize(end);
+            if (!data.empty() && !compressed.push(Batch{number++, std::move(data)}))
+                return;
+            data = std::move(rest);
+        }
+        compressed.close();
+    }
+
+    // Inflates the blocks of one batch after the other.
+    void inflate_batches()
+    {
+        z_stream stream{};
+        if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+            throw RuntimeError("Unable to initialise zlib.");
+
+        try
+        {
+            Batch batch;
+            while (compressed.pop(batch))
+            {
+                auto blocks = reinterpret_cast<unsigned char const *>(batch.data.data());
+                size_t size = 0;
+                for (size_t pos = 0, block_size; pos < batch.data.size(); pos += block_size)
+                {
+                    block_size = bgzf_block_size(blocks + pos, batch.data.size() - pos);
+                    size += read_le32(blocks + pos + block_size - 4);
+                }
+
+                std::string output(size, '\0');
+                size_t written = 0;
+                for (size_t pos = 0; pos < batch.data.size();)
+                {
+                    unsigned char const * block = blocks + pos;
+                    size_t block_size = bgzf_block_size(block, batch.data.size() - pos);
+                    size_t header_size = 12 + (block[10] | block[11] << 8);
+                    uint32_t crc = read_le32(block + block_size - 8);
+                    uint32_t block_output = read_le32(block + block_size - 4);
+                    unsigned char * out = reinterpret_cast<unsigned char *>(&output[0]) + written;
+
+                    inflateReset(&stream);
+                    stream.next_in = const_cast<unsigned char *>(block + header_size);
+                    stream.avail_in = block_size - header_size - 8;
+                    stream.next_out = out;
+                    stream.avail_out = block_output;
+                    if (inflate(&stream, Z_FINISH) != Z_STREAM_END || stream.avail_out != 0 ||
+                        crc32(0, out, block_output) != crc)
+                        throw IOError("Corrupt BGZF block.");
+                    written += block_output;
+                    pos += block_size;
+                }
+                if (!inflated.push(batch.number, std::move(output)))
+                    break;
+            }
+        }
+        catch (...)
+        {
+            inflateEnd(&stream);
+            throw;
+        }
+        inflateEnd(&stream);
+        // The last inflater marks the end of the output.
+        if (--active == 0)
+            inflated.close();
+    }
+
+    // Inflates a plain gzip file, possibly consisting of several members.
+    void inflate_stream()
+    {
+        z_stream stream{};
+        if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK)
+            throw RuntimeError("Unable to initialise zlib.");
+
+        try
+        {
+            std::vector<char> input(batch_size);
+            std::string output;
+            uint64_t number = 0;
+            bool member_begin = true;
+            while (true)
+            {
+                if (stream.avail_in == 0)
+                {
+                    size_t bytes = file.read(input.data(), input.size());
+                    if (bytes == 0)
+                    {
+                        if (!member_begin)
+                            throw IOError("Truncated gzip file.");
+                        break;
+                    }
+                    stream.next_in = reinterpret_cast<unsigned char *>(input.data());
+                    stream.avail_in = bytes;
+                }
+                if (stream.avail_out == 0)
+                {
+                    if (!output.empty() && !inflated.push(number++, std::move(output)))
+                        break;
+                    output.assign(chunk_size, '\0');
+                    stream.next_out = reinterpret_cast<unsigned char *>(&output[0]);
+                    stream.avail_out = chunk_size;
+                }
+
+                member_begin = false;
+                int status = inflate(&stream, Z_NO_FLUSH);
+                if (status == Z_STREAM_END)
+                {
+                    inflateReset(&stream);
+                    member_begin = true;
+                }
+                else if (status != Z_OK && status != Z_BUF_ERROR)
+                {
+                    throw IOError("Corrupt gzip file.");
+                }
+            }
+            if (!output.empty())
+            {
+                output.resize(chunk_size - stream.avail_out);
+                inflated.push(number, std::move(output));
+            }
+        }
+        catch (...)
+        {
+            inflateEnd(&stream);
+            throw;
+        }
+        inflateEnd(&stream);
+        inflated.close();
+    }
+
+    static uint32_t read_le32(unsigned char const * data)
+    {
+        return data[0] | data[1] << 8 | data[2] << 16 | static_cast<uint32_t>(data[3]) << 24;
+    }
+};
+
+#endif  // SEQAN_HAS_ZLIB
+
+#endif  // SRA_SEARCH_DECOMPRESS_H_
@@ -0,0 +1,127 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#ifndef SRA_SEARCH_DISPATCH_H_
+#define SRA_SEARCH_DISPATCH_H_
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#include <seqan/binning_directory.h>
+
+using namespace seqan;
+
+// ----------------------------------------------------------------------------
+// Minimizer configurations
+// ----------------------------------------------------------------------------
+// The (k, w) pairs that the tools are compiled for. Every pair is a separate
+// instantiation of the hashing and filter code, so adding a pair here is all
+// that is needed to support it, at the price of compile time and binary size.
+
+template <typename TMinimizer>
+struct MinimizerTag
+{
+    typedef TMinimizer Type;
+};
+
+template <typename ... TMinimizers>
+struct MinimizerList {};
+
+typedef MinimizerList<Minimizer<16, 20>,
+                      Minimizer<19, 19>,
+                      Minimizer<19, 23>,
+                      Minimizer<19, 24>,
+                      Minimizer<19, 25>,
+                      Minimizer<20, 24>,
+                      Minimizer<20, 25>,
+                      Minimizer<23, 27>> SupportedMinimizers;
+
+// ----------------------------------------------------------------------------
+// Function supported_minimizers()
+// ----------------------------------------------------------------------------
+
+inline void supported_minimizers(std::ostream &, MinimizerList<>) {}
+
+template <uint16_t k, uint32_t w, typename ... TRest>
+inline void supported_minimizers(std::ostream & out, MinimizerList<Minimizer<k, w>, TRest...>)
+{
+    out << " (" << k << ", " << w << ")";
+    supported_minimizers(out, MinimizerList<TRest...>());
+}
+
+inline std::string supported_minimizers()
+{
+    std::ostringstream out;
+    supported_minimizers(out, SupportedMinimizers());
+    return out.str();
+}
+
+// ----------------------------------------------------------------------------
+// Function dispatch_minimizer()
+// ----------------------------------------------------------------------------
+// Calls f(MinimizerTag<Minimizer<k, w>>()) for the compiled-in configuration
+// matching the runtime values. Throws if the combination is not supported, so
+// the templates can never disagree with the requested parameters.
+
+template <typename TFunctor>
+inline bool dispatch_minimizer(uint32_t, uint32_t, TFunctor &&, MinimizerList<>)
+{
+    return false;
+}
+
+template <uint16_t k, uint32_t w, typename ... TRest, typename TFunctor>
+inline bool dispatch_minimizer(uint32_t kmer_size, uint32_t window_size, TFunctor && f,
+                               MinimizerList<Minimizer<k, w>, TRest...>)
+{
+    if (kmer_size == k && window_size == w)
+    {
+        f(MinimizerTag<Minimizer<k, w>>());
+        return true;
+    }
+    return dispatch_minimizer(kmer_size, window_size, f, MinimizerList<TRest...>());
+}
+
+template <typename TFunctor>
+inline void dispatch_minimizer(uint32_t kmer_size, uint32_t window_size, TFunctor && f)
+{
+    if (!dispatch_minimizer(kmer_size, window_size, f, SupportedMinimizers()))
+    {
+        throw RuntimeError("Unsupported combination of k-mer size " + std::to_string(kmer_size) +
+                           " and window size " + std::to_string(window_size) +
+                           ". Supported (k, w):" + supported_minimizers());
+    }
+}
+
+#endif  // SRA_SEARCH_DISPATCH_H_
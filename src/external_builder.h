@@ -0,0 +1,311 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#ifndef SRA_SEARCH_EXTERNAL_BUILDER_H_
+#define SRA_SEARCH_EXTERNAL_BUILDER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ibf.h"
+
+// ----------------------------------------------------------------------------
+// Class ExternalIbfBuilder
+// ----------------------------------------------------------------------------
+// Builds an InterleavedBloomFilter that does not fit into memory. The bit
+// vector is split into regions of at most half the memory limit. Like the one
+// of IbfBuilder, an Inserter buffers the bit positions per region, but a full
+// buffer is sorted, deduplicated and appended as a run to a temporary file of
+// the region, delta and varint encoded. store() then sets the bits of one
+// region at a time from its runs and appends the region to the filter file.
+// The other half of the memory limit holds the buffers of all threads, one
+// per thread and region. Every buffer has to hold at least min_run_positions,
+// so the memory limit has to grow with the square root of the filter size
+// times the number of threads; a smaller limit is rejected up front.
+
+class ExternalIbfBuilder
+{
+public:
+    // 128 KiB of positions per buffer, smaller runs cost more in opening and appending to the file than in writing.
+    static const uint64_t min_run_positions{1 << 14};
+
+    IbfLayout   layout;
+
+    // layout.bits has to be a multiple of 64, the runs are <tmp_prefix>.region<r>.
+    ExternalIbfBuilder(IbfLayout const & layout, uint64_t memory, CharString const & tmp_prefix, unsigned threads) :
+        layout(layout),
+        tmp_prefix(toCString(tmp_prefix)),
+        threads(std::max(1u, threads)),
+        written_bytes(0)
+    {
+        if (layout.groups == 0)
+        {
+            throw RuntimeError("The filter size is too small for " + std::to_string(layout.number_of_bins) + " bins!");
+        }
+        if (layout.bits == std::numeric_limits<uint64_t>::max())
+        {
+            throw RuntimeError("A direct-addressed filter for k = " + std::to_string(layout.kmer_size) +
+                               " is too large!");
+        }
+        uint64_t data_words = layout.bits / 64;
+        region_words = std::max<uint64_t>(1, memory / 2 / sizeof(uint64_t) / layout.bin_width) * layout.bin_width;
+        region_words = std::min(region_words, data_words);
+        number_of_regions = (data_words + region_words - 1) / region_words;
+        buffer_capacity = memory / 2 / sizeof(uint64_t) / this->threads / number_of_regions;
+        if (buffer_capacity < min_run_positions || region_words * sizeof(uint64_t) > memory / 2)
+        {
+            // Half of the memory for the region and half for threads * regions buffers is smallest for regions of
+            // sqrt(threads * min_run_positions * data_words) words.
+            double needed = 2 * sizeof(uint64_t) * std::sqrt(static_cast<double>(this->threads) * min_run_positions *
+                                                             std::max(data_words, layout.bin_width));
+            throw RuntimeError("--memory is too small to build a filter of " +
+                               std::to_string(data_words * sizeof(uint64_t) >> 20) + " MiB out of core with " +
+                               std::to_string(this->threads) + " threads, it needs at least " +
+                               std::to_string((static_cast<uint64_t>(needed) >> 20) + 1) + " MiB.");
+        }
+        region_mtx.reset(new std::mutex[number_of_regions]);
+        // Runs are only ever appended, remove the ones of an aborted build.
+        remove_runs();
+    }
+
+    ExternalIbfBuilder(ExternalIbfBuilder const &) = delete;
+    ExternalIbfBuilder & operator=(ExternalIbfBuilder const &) = delete;
+
+    ~ExternalIbfBuilder()
+    {
+        remove_runs();
+    }
+
+    uint64_t regions() const
+    {
+        return number_of_regions;
+    }
+
+    // Bytes of all runs written so far.
+    uint64_t run_bytes() const
+    {
+        return written_bytes;
+    }
+
+    class Inserter
+    {
+    public:
+        explicit Inserter(ExternalIbfBuilder & builder) :
+            builder(builder),
+            buffers(builder.number_of_regions) {}
+
+        Inserter(Inserter const &) = delete;
+        Inserter & operator=(Inserter const &) = delete;
+
+        ~Inserter()
+        {
+            flush();
+        }
+
+        inline void insert(uint64_t kmer_hash, uint64_t bin_number)
+        {
+            IbfLayout const & layout = builder.layout;
+            for (uint64_t i = 0; i < layout.number_of_hashes; ++i)
+            {
+                uint64_t block_word = layout.block_word(kmer_hash, i);
+                uint64_t region = block_word / builder.region_words;
+                std::vector<uint64_t> & buffer = buffers[region];
+                // Allocate exactly the capacity, push_back would double it.
+                if (buffer.capacity() == 0)
+                    buffer.reserve(builder.buffer_capacity);
+                buffer.push_back((block_word - region * builder.region_words) * 64 + bin_number);
+                if (buffer.size() >= builder.buffer_capacity)
+                    builder.write_run(region, buffer);
+            }
+        }
+
+        void flush()
+        {
+            for (uint64_t region = 0; region < buffers.size(); ++region)
+                if (!buffers[region].empty())
+                    builder.write_run(region, buffers[region]);
+        }
+
+    private:
+        ExternalIbfBuilder &                builder;
+        std::vector<std::vector<uint64_t>>  buffers;
+    };
+
+private:
+    std::string                     tmp_prefix;
+    unsigned                        threads;
+    uint64_t                        region_words;
+    uint64_t                        number_of_regions;
+    uint64_t                        buffer_capacity;
+    std::unique_ptr<std::mutex[]>   region_mtx;
+    std::atomic<uint64_t>           written_bytes;
+
+    std::string run_file(uint64_t region) const
+    {
+        return tmp_prefix + ".region" + std::to_string(region);
+    }
+
+    void remove_runs() const
+    {
+        for (uint64_t region = 0; region < number_of_regions; ++region)
+            std::remove(run_file(region).c_str());
+    }
+
+    // Appends the positions as a run: their number followed by the differences of the sorted positions, every number
+    // as a varint of 7 bits per byte.
+    void write_run(uint64_t region, std::vector<uint64_t> & positions)
+    {
+        std::sort(positions.begin(), positions.end());
+        positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+
+        std::lock_guard<std::mutex> lock(region_mtx[region]);
+        std::ofstream out(run_file(region), std::ios::binary | std::ios::app);
+        char encoded[1 << 16];
+        size_t size{0};
+        auto put = [&] (uint64_t value) {
+            if (size + 10 > sizeof(encoded))
+            {
+                out.write(encoded, size);
+                written_bytes += size;
+                size = 0;
+            }
+            for (; value >= 0x80; value >>= 7)
+                encoded[size++] = static_cast<char>(value | 0x80);
+            encoded[size++] = static_cast<char>(value);
+        };
+        put(positions.size());
+        uint64_t previous{0};
+        for (uint64_t position : positions)
+        {
+            put(position - previous);
+            previous = position;
+        }
+        out.write(encoded, size);
+        written_bytes += size;
+        if (!out)
+            throw IOError("Unable to write temporary file: " + run_file(region));
+        positions.clear();
+    }
+
+    // Sets the bits of all runs of the region in its words.
+    void read_runs(uint64_t region, std::vector<uint64_t> & words) const
+    {
+        std::ifstream in(run_file(region), std::ios::binary);
+        // No minimizer fell into the region.
+        if (!in)
+            return;
+        std::vector<char> buffer(1 << 20);
+        size_t size{0};
+        size_t pos{0};
+        auto get = [&] (uint64_t & value) {
+            value = 0;
+            for (unsigned shift = 0; ; shift += 7)
+            {
+                if (pos == size)
+                {
+                    in.read(buffer.data(), buffer.size());
+                    size = in.gcount();
+                    pos = 0;
+                    if (size == 0)
+                    {
+                        if (shift != 0)
+                            throw IOError("Temporary file " + run_file(region) + " is truncated.");
+                        return false;
+                    }
+                }
+                uint8_t byte = buffer[pos++];
+                value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                if (byte < 0x80)
+                    return true;
+            }
+        };
+        uint64_t count;
+        while (get(count))
+        {
+            uint64_t position{0};
+            for (uint64_t i = 0; i < count; ++i)
+            {
+                uint64_t delta;
+                if (!get(delta) || position + delta >= words.size() * 64)
+                    throw IOError("Temporary file " + run_file(region) + " is corrupt.");
+                position += delta;
+                words[position / 64] |= 1ULL << (position % 64);
+            }
+        }
+    }
+
+    friend void store(ExternalIbfBuilder & me, CharString const & file_name);
+};
+
+// ----------------------------------------------------------------------------
+// Function store()
+// ----------------------------------------------------------------------------
+// Writes the filter in the format of store() for an IbfBuilder, one region at
+// a time. The runs of a region are removed once it is written.
+
+inline void store(ExternalIbfBuilder & me, CharString const & file_name)
+{
+    IbfLayout const & layout = me.layout;
+    std::ofstream out(toCString(file_name), std::ios::binary);
+    uint64_t vector_bits = layout.bits + IbfLayout::metadata_bits;
+    out.write(reinterpret_cast<char const *>(&vector_bits), sizeof(vector_bits));
+
+    uint64_t data_words = layout.bits / 64;
+    std::vector<uint64_t> words;
+    for (uint64_t region = 0; region < me.number_of_regions; ++region)
+    {
+        uint64_t first_word = region * me.region_words;
+        words.assign(std::min(me.region_words, data_words - first_word), 0);
+        me.read_runs(region, words);
+        out.write(reinterpret_cast<char const *>(words.data()), words.size() * sizeof(uint64_t));
+        std::remove(me.run_file(region).c_str());
+    }
+
+    uint64_t metadata[IbfLayout::metadata_bits / 64];
+    layout.encode_metadata(metadata);
+    out.write(reinterpret_cast<char const *>(metadata), sizeof(metadata));
+    if (!out)
+    {
+        throw IOError("Unable to write filter file: " + std::string(toCString(file_name)));
+    }
+}
+
+#endif  // SRA_SEARCH_EXTERNAL_BUILDER_H_
@@ -0,0 +1,461 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#ifndef SRA_SEARCH_FASTX_READER_H_
+#define SRA_SEARCH_FASTX_READER_H_
+
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <seqan/basic.h>
+#include <seqan/sequence.h>
+#include <seqan/seq_io.h>
+
+#include "block_source.h"
+#include "decompress.h"
+
+using namespace seqan;
+
+// ----------------------------------------------------------------------------
+// Class RankView
+// ----------------------------------------------------------------------------
+// A sequence as ranks of Dna5 (A, C, G, T, N = 0 to 4), one byte per base,
+// pointing into a buffer of its reader. The minimizer engine reads the ranks
+// directly, no Dna5String is built.
+
+struct RankView
+{
+    uint8_t const * data;
+    size_t          size;
+
+    uint8_t operator[](size_t i) const
+    {
+        return data[i];
+    }
+};
+
+inline size_t length(RankView const & view)
+{
+    return view.size;
+}
+
+// ----------------------------------------------------------------------------
+// Class IdView
+// ----------------------------------------------------------------------------
+// The id of a record without the leading '>' or '@', pointing into a buffer
+// of its reader.
+
+struct IdView
+{
+    char const *    data;
+    size_t          size;
+};
+
+inline char const * begin(IdView const & view, Standard const &)
+{
+    return view.data;
+}
+
+inline char const * end(IdView const & view, Standard const &)
+{
+    return view.data + view.size;
+}
+
+// ----------------------------------------------------------------------------
+// Class FastxReader
+// ----------------------------------------------------------------------------
+// Reads FASTA and FASTQ records in large blocks. Lines are found with memchr,
+// which scans a vector register at a time, and the bases are translated to
+// ranks into a buffer that is reused for every record. FASTQ ids point into
+// the block, which always holds the whole current record. FASTA records may
+// span many blocks, their ids are copied.
+//
+// A reader can be restricted to the records whose header line starts within
+// [begin, end) of an uncompressed file, so that one file is parsed by several
+// threads. FASTQ records must span exactly four lines.
+
+struct FastxRecord
+{
+    IdView      id;
+    RankView    seq;
+};
+
+class FastxReader
+{
+public:
+    static const size_t default_block_size{8ULL << 20};
+
+    FastxReader(CharString const & file_name, uint64_t begin = 0,
+                uint64_t end = std::numeric_limits<uint64_t>::max(), size_t block_size = default_block_size) :
+        source(new FileSource(file_name, begin > 0 ? begin - 1 : 0)),
+        buffer(block_size),
+        record_begin(0),
+        pos(0),
+        limit(0),
+        offset(begin > 0 ? begin - 1 : 0),
+        end(end),
+        at_end(false),
+        fastq(begin > 0 && is_fastq_file(file_name))
+    {
+        init(begin > 0);
+    }
+
+    FastxReader(std::unique_ptr<BlockSource> source, size_t block_size = default_block_size) :
+        source(std::move(source)),
+        buffer(block_size),
+        record_begin(0),
+        pos(0),
+        limit(0),
+        offset(0),
+        end(std::numeric_limits<uint64_t>::max()),
+        at_end(false),
+        fastq(false)
+    {
+        init(false);
+    }
+
+    // Reads the next record, its views stay valid until the next call.
+    bool next(FastxRecord & record)
+    {
+        record_begin = pos;
+        if (!available(1) || offset + pos >= end)
+            return false;
+
+        size_t header_begin, header_end;
+        next_line(header_begin, header_end);
+        ranks.clear();
+        if (fastq)
+        {
+            size_t seq_begin, seq_end, plus_begin, plus_end, quality_begin, quality_end;
+            if (!next_line(seq_begin, seq_end) || !next_line(plus_begin, plus_end) ||
+                !next_line(quality_begin, quality_end))
+                throw ParseError("Incomplete FASTQ record.");
+            translate(seq_begin, seq_end);
+            record.id = IdView{buffer.data() + record_begin + header_begin + 1, header_end - header_begin - 1};
+        }
+        else
+        {
+            id.assign(buffer.data() + record_begin + header_begin + 1, header_end - header_begin - 1);
+            // The sequence lines are translated right away, the block only has to hold one line.
+            size_t line_begin, line_end;
+            while (available(1) && buffer[pos] != '>')
+            {
+                record_begin = pos;
+                next_line(line_begin, line_end);
+                translate(line_begin, line_end);
+            }
+            record.id = IdView{id.data(), id.size()};
+        }
+        record.seq = RankView{ranks.data(), ranks.size()};
+        return true;
+    }
+
+private:
+    std::unique_ptr<BlockSource>    source;
+    std::vector<char>               buffer;
+    // Offsets into buffer: start of the current record, next unread byte, end of the data.
+    size_t                          record_begin;
+    size_t                          pos;
+    size_t                          limit;
+    // File offset of buffer[0] and of the first record that is not read any more.
+    uint64_t                        offset;
+    uint64_t                        end;
+    bool                            at_end;
+    bool                            fastq;
+    std::vector<uint8_t>            ranks;
+    std::string                     id;
+
+    static bool is_fastq_file(CharString const & file_name)
+    {
+        char first{0};
+        FileSource(file_name).read(&first, 1);
+        return first == '@';
+    }
+
+    // Skips to the first record when starting in the middle of a file.
+    void init(bool synchronize)
+    {
+        if (!synchronize)
+        {
+            fastq = available(1) && buffer[pos] == '@';
+            return;
+        }
+
+        // Skip the line containing byte begin - 1, so the next line is the first one starting at or after begin.
+        size_t line_begin, line_end;
+        next_line(line_begin, line_end);
+        while (true)
+        {
+            record_begin = pos;
+            if (!available(1))
+                return;
+            if (!fastq && buffer[pos] == '>')
+                return;
+            if (fastq && buffer[pos] == '@')
+            {
+                // Quality lines may start with '@' as well, a header is followed by a sequence and a '+' line.
+                bool header = next_line(line_begin, line_end) && next_line(line_begin, line_end) &&
+                              next_line(line_begin, line_end) && line_end > line_begin &&
+                              buffer[record_begin + line_begin] == '+';
+                pos = record_begin;
+                if (header)
+                    return;
+            }
+            next_line(line_begin, line_end);
+        }
+    }
+
+    // Makes sure that count bytes after pos are in the buffer, keeping the current record.
+    bool available(size_t count)
+    {
+        while (limit - pos < count)
+        {
+            if (at_end)
+                return false;
+            refill();
+        }
+        return true;
+    }
+
+    void refill()
+    {
+        if (record_begin > 0)
+        {
+            std::memmove(buffer.data(), buffer.data() + record_begin, limit - record_begin);
+            offset += record_begin;
+            pos -= record_begin;
+            limit -= record_begin;
+            record_begin = 0;
+        }
+        if (limit == buffer.size())
+            buffer.resize(2 * buffer.size());
+        size_t bytes = source->read(buffer.data() + limit, buffer.size() - limit);
+        if (bytes == 0)
+            at_end = true;
+        limit += bytes;
+    }
+
+    // Reads the next line, its bounds are returned relative to record_begin and
+    // exclude the line break. Returns false at the end of the input.
+    bool next_line(size_t & line_begin, size_t & line_end)
+    {
+        if (!available(1))
+            return false;
+        size_t scanned = pos;
+        char const * newline;
+        while (!(newline = static_cast<char const *>(std::memchr(buffer.data() + scanned, '\n', limit - scanned))))
+        {
+            scanned = limit;
+            size_t before = record_begin;
+            if (at_end)
+                break;
+            refill();
+            scanned -= before - record_begin;
+        }
+        line_begin = pos - record_begin;
+        size_t stop = newline ? newline - buffer.data() : limit;
+        pos = newline ? stop + 1 : stop;
+        if (stop > record_begin + line_begin && buffer[stop - 1] == '\r')
+            --stop;
+        line_end = stop - record_begin;
+        return true;
+    }
+
+    void translate(size_t line_begin, size_t line_end)
+    {
+        static const RankTable table;
+        size_t old_size = ranks.size();
+        ranks.resize(old_size + line_end - line_begin);
+        uint8_t const * in = reinterpret_cast<uint8_t const *>(buffer.data() + record_begin + line_begin);
+        uint8_t * out = ranks.data() + old_size;
+        for (size_t i = 0; i < line_end - line_begin; ++i)
+            out[i] = table.ranks[in[i]];
+    }
+
+    struct RankTable
+    {
+        uint8_t ranks[256];
+
+        RankTable()
+        {
+            std::memset(ranks, 4, sizeof(ranks));
+            ranks['A'] = ranks['a'] = 0;
+            ranks['C'] = ranks['c'] = 1;
+            ranks['G'] = ranks['g'] = 2;
+            ranks['T'] = ranks['t'] = ranks['U'] = ranks['u'] = 3;
+        }
+    };
+};
+
+// ----------------------------------------------------------------------------
+// Function has_extension()
+// ----------------------------------------------------------------------------
+
+inline bool has_extension(CharString const & file_name, std::initializer_list<std::string> extensions)
+{
+    std::string name = toCString(file_name);
+    for (std::string ext : extensions)
+    {
+        if (name.size() >= ext.size() && name.compare(name.size() - ext.size(), ext.size(), ext) == 0)
+            return true;
+    }
+    return false;
+}
+
+// ----------------------------------------------------------------------------
+// Function is_compressed_file()
+// ----------------------------------------------------------------------------
+
+inline bool is_compressed_file(CharString const & file_name)
+{
+    return has_extension(file_name, {".gz", ".bgzf", ".bz2"});
+}
+
+// ----------------------------------------------------------------------------
+// Class SequenceFile
+// ----------------------------------------------------------------------------
+// Reads the records of a sequence file with a FastxReader. gzip and BGZF
+// files are inflated by an InflateSource using up to `threads` threads, other
+// compressed files are read through SeqFileIn. Ranges [begin, end) are only
+// supported for uncompressed files.
+
+class SequenceFile
+{
+public:
+    SequenceFile(CharString const & file_name, uint64_t begin = 0,
+                 uint64_t end = std::numeric_limits<uint64_t>::max(), unsigned threads = 1)
+    {
+        if (!is_compressed_file(file_name))
+        {
+            reader.reset(new FastxReader(file_name, begin, end));
+        }
+#if SEQAN_HAS_ZLIB
+        else if (has_extension(file_name, {".gz", ".bgzf"}))
+        {
+            reader.reset(new FastxReader(std::unique_ptr<BlockSource>(new InflateSource(file_name, threads))));
+        }
+#endif
+        else if (!open(seq_file_in, toCString(file_name)))
+        {
+            throw IOError("Unable to open file: " + std::string(toCString(file_name)));
+        }
+        (void) threads;
+    }
+
+    bool next(FastxRecord & record)
+    {
+        if (reader)
+            return reader->next(record);
+
+        if (atEnd(seq_file_in))
+            return false;
+        readRecord(id, seq, seq_file_in);
+        ranks.resize(length(seq));
+        for (size_t i = 0; i < ranks.size(); ++i)
+            ranks[i] = ordValue(seq[i]);
+        record.id = IdView{toCString(id), length(id)};
+        record.seq = RankView{ranks.data(), ranks.size()};
+        return true;
+    }
+
+private:
+    std::unique_ptr<FastxReader>    reader;
+    SeqFileIn                       seq_file_in;
+    CharString                      id;
+    Dna5String                      seq;
+    std::vector<uint8_t>            ranks;
+};
+
+// ----------------------------------------------------------------------------
+// Class RecordBatch
+// ----------------------------------------------------------------------------
+// Owns copies of records, e.g. a chunk of reads handed to another thread.
+// The ids and sequences of all records share one buffer each.
+
+class RecordBatch
+{
+public:
+    RecordBatch() :
+        id_ends(1, 0),
+        seq_ends(1, 0) {}
+
+    void clear()
+    {
+        ids.clear();
+        ranks.clear();
+        id_ends.resize(1);
+        seq_ends.resize(1);
+    }
+
+    void push_back(FastxRecord const & record)
+    {
+        ids.append(record.id.data, record.id.size);
+        ranks.insert(ranks.end(), record.seq.data, record.seq.data + record.seq.size);
+        id_ends.push_back(ids.size());
+        seq_ends.push_back(ranks.size());
+    }
+
+    size_t size() const
+    {
+        return seq_ends.size() - 1;
+    }
+
+    IdView id(size_t i) const
+    {
+        return IdView{ids.data() + id_ends[i], id_ends[i + 1] - id_ends[i]};
+    }
+
+    RankView operator[](size_t i) const
+    {
+        return RankView{ranks.data() + seq_ends[i], seq_ends[i + 1] - seq_ends[i]};
+    }
+
+private:
+    std::string             ids;
+    std::vector<uint8_t>    ranks;
+    std::vector<size_t>     id_ends;
+    std::vector<size_t>     seq_ends;
+};
+
+inline size_t length(RecordBatch const & batch)
+{
+    return batch.size();
+}
+
+#endif  // SRA_SEARCH_FASTX_READER_H_
@@ -65,6 +65,12 @@
 // Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
 // ==========================================================================
 
+#include <deque>
+#include <limits>
+#include <mutex>
+
+#include "fastx_reader.h"
+#include "stats.h"
 
 using namespace seqan;
 
@@ -319,3 +325,168 @@ std::ostream& operator<<(std::ostream& s, const std::vector<T>& v) {
     }
     return s;
 }
+
+// ----------------------------------------------------------------------------
+// Class BinScheduler
+// ----------------------------------------------------------------------------
+// Hands out the bins [first_bin, first_bin + number_of_bins) of a reference
+// directory, or an explicit list of bin files, to the worker threads. Bins
+// are scheduled largest file first; uncompressed files that are larger than
+// chunk_bytes are split into byte ranges that are processed independently.
+// The work is dealt to per-thread queues by current load, a thread that has
+// run out of work steals the smallest remaining item of the busiest thread.
+
+struct BinWork
+{
+    uint32_t    bin_number;
+    CharString  file_path;
+    uint64_t    begin;
+    uint64_t    end;
+    uint32_t    chunks;     // number of work items of this bin
+};
+
+class BinScheduler
+{
+public:
+    static std::vector<std::pair<uint32_t, CharString>> bin_files(CharString const & directory_path,
+                                                                  std::string const & ext,
+                                                                  uint32_t first_bin,
+                                                                  uint32_t number_of_bins)
+    {
+        std::vector<std::pair<uint32_t, CharString>> files;
+        for (uint32_t bin_number = first_bin; bin_number < first_bin + number_of_bins; ++bin_number)
+        {
+            CharString file_path;
+            append_file_name(file_path, directory_path, bin_number);
+            append(file_path, ext);
+            files.emplace_back(bin_number, file_path);
+        }
+        return files;
+    }
+
+    BinScheduler(CharString const & directory_path, std::string const & ext, uint32_t first_bin,
+                 uint32_t number_of_bins, unsigned threads, uint64_t chunk_bytes = 0) :
+        BinScheduler(bin_files(directory_path, ext, first_bin, number_of_bins), threads, chunk_bytes) {}
+
+    BinScheduler(std::vector<std::pair<uint32_t, CharString>> const & files, unsigned threads,
+                 uint64_t chunk_bytes = 0) :
+        queues(std::max(1u, threads)),
+        loads(std::max(1u, threads), 0),
+        queue_mtx(std::max(1u, threads))
+    {
+        std::vector<std::pair<uint64_t, BinWork>> items;
+        std::vector<uint64_t> file_sizes(files.size(), 0);
+        uint64_t total_size{0};
+        for (size_t file = 0; file < files.size(); ++file)
+        {
+            struct stat st;
+            if (stat(toCString(files[file].second), &st) == 0)
+                file_sizes[file] = st.st_size;
+            total_size += file_sizes[file];
+        }
+
+        if (chunk_bytes == 0)
+            chunk_bytes = std::max<uint64_t>(total_size / (4 * queues.size()), 32ULL << 20);
+
+        for (size_t file = 0; file < files.size(); ++file)
+        {
+            // SequenceFile reads compressed files as a whole, whatever the range.
+            bool splittable = !is_compressed_file(files[file].second);
+            uint64_t size = file_sizes[file];
+            uint32_t chunks = (splittable && size > chunk_bytes) ? (size + chunk_bytes - 1) / chunk_bytes : 1;
+            for (uint32_t chunk = 0; chunk < chunks; ++chunk)
+            {
+                BinWork work;
+                work.bin_number = files[file].first;
+                work.file_path = files[file].second;
+                work.begin = (chunks == 1) ? 0 : chunk * chunk_bytes;
+                work.end = (chunks == 1) ? std::numeric_limits<uint64_t>::max()
+                                         : std::min(size, (chunk + 1) * chunk_bytes);
+                work.chunks = chunks;
+                items.emplace_back((chunks == 1) ? size : work.end - work.begin, work);
+            }
+        }
+
+        // Longest processing time first: every item goes to the least loaded queue.
+        std::stable_sort(items.begin(), items.end(), [] (std::pair<uint64_t, BinWork> const & a,
+                                                          std::pair<uint64_t, BinWork> const & b) {
+            return a.first > b.first;
+        });
+        for (auto & item : items)
+        {
+            size_t queue = std::min_element(loads.begin(), loads.end()) - loads.begin();
+            loads[queue] += item.first;
+            queues[queue].emplace_back(item.first, std::move(item.second));
+        }
+    }
+
+    bool next(unsigned thread_id, BinWork & work)
+    {
+        size_t own = thread_id % queues.size();
+        {
+            std::lock_guard<std::mutex> lock(queue_mtx[own]);
+            if (!queues[own].empty())
+            {
+                loads[own] -= queues[own].front().first;
+                work = std::move(queues[own].front().second);
+                queues[own].pop_front();
+                return true;
+            }
+        }
+        // Steal from the back of the queue with the most remaining work.
+        while (true)
+        {
+            bool found{false};
+            size_t victim{0};
+            uint64_t victim_load{0};
+            for (size_t queue = 0; queue < queues.size(); ++queue)
+            {
+                std::lock_guard<std::mutex> lock(queue_mtx[queue]);
+                if (!queues[queue].empty() && (!found || loads[queue] > victim_load))
+                {
+                    found = true;
+                    victim = queue;
+                    victim_load = loads[queue];
+                }
+            }
+            if (!found)
+                return false;
+
+            std::lock_guard<std::mutex> lock(queue_mtx[victim]);
+            if (queues[victim].empty())
+                continue;
+            loads[victim] -= queues[victim].back().first;
+            work = std::move(queues[victim].back().second);
+            queues[victim].pop_back();
+            return true;
+        }
+    }
+
+private:
+    std::vector<std::deque<std::pair<uint64_t, BinWork>>>   queues;
+    std::vector<uint64_t>                                   loads;
+    std::vector<std::mutex>                                 queue_mtx;
+};
+
+// ----------------------------------------------------------------------------
+// Function read_work()
+// ----------------------------------------------------------------------------
+// Calls f(seq) with the RankView of every record of a work item of the
+// BinScheduler. Parsing is recorded as STAGE_READ if a recorder is given.
+
+template <typename TFunctor>
+inline void read_work(BinWork const & work, TFunctor && f, StatsRecorder * recorder = nullptr)
+{
+    SequenceFile file(work.file_path, work.begin, work.end);
+    FastxRecord record;
+    while (true)
+    {
+        {
+            StageTimer timer(recorder, STAGE_READ);
+            if (!file.next(record))
+                break;
+            timer.add_items(record.seq.size);
+        }
+        f(record.seq);
+    }
+}
@@ -0,0 +1,420 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#ifndef SRA_SEARCH_HIERARCHY_H_
+#define SRA_SEARCH_HIERARCHY_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <seqan/sequence.h>
+
+#include "ibf.h"
+
+using namespace seqan;
+
+// ----------------------------------------------------------------------------
+// Class HierarchyManifest
+// ----------------------------------------------------------------------------
+// A hierarchical filter for many bins of skewed sizes. The bins (user bins)
+// are merged into technical bins of similar total size, a top-level filter
+// holds one bin per technical bin. Every technical bin that merges more than
+// one user bin has a lower-level filter with one bin per user bin, which is
+// only queried if the technical bin passes the threshold. The manifest is a
+// text file that takes the place of the filter file:
+//
+//   #SRA_search hierarchy
+//   <number of bins>
+//   <top-level filter file>
+//   <lower-level filter file or -> <user bin>...   (one line per technical bin)
+//
+// Filter files are stored relative to the directory of the manifest.
+
+struct TechnicalBin
+{
+    std::vector<uint32_t>   user_bins;
+    // Empty if the technical bin holds a single user bin.
+    CharString              file_name;
+};
+
+struct HierarchyManifest
+{
+    uint64_t                    number_of_bins;
+    CharString                  top_level_file;
+    std::vector<TechnicalBin>   technical_bins;
+};
+
+static const std::string HIERARCHY_MANIFEST_HEADER{"#SRA_search hierarchy"};
+
+// ----------------------------------------------------------------------------
+// Function is_hierarchy_manifest()
+// ----------------------------------------------------------------------------
+
+inline bool is_hierarchy_manifest(CharString const & file_name)
+{
+    std::ifstream in(toCString(file_name), std::ios::binary);
+    std::string header(HIERARCHY_MANIFEST_HEADER.size(), '\0');
+    in.read(&header[0], header.size());
+    return in && header == HIERARCHY_MANIFEST_HEADER;
+}
+
+// ----------------------------------------------------------------------------
+// Function hierarchy_layout()
+// ----------------------------------------------------------------------------
+// Merges the user bins with the given sizes into number_of_technical_bins
+// technical bins. The user bins are taken largest first, every technical bin
+// is filled up to the average size of the technical bins that are left, so a
+// user bin above the average stays alone and the small ones are merged with
+// bins of similar size. User bins are not split.
+
+inline void hierarchy_layout(HierarchyManifest & me, CharString const & file_name, std::vector<uint64_t> const & sizes,
+                             uint64_t number_of_technical_bins)
+{
+    uint64_t number_of_bins = sizes.size();
+    std::vector<uint32_t> order(number_of_bins);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&sizes] (uint32_t a, uint32_t b) {
+        return sizes[a] > sizes[b];
+    });
+
+    uint64_t remaining_size = std::accumulate(sizes.begin(), sizes.end(), 0ULL);
+    uint64_t technical_bins = std::min(number_of_technical_bins, number_of_bins);
+    uint64_t next{0};
+    me.number_of_bins = number_of_bins;
+    me.top_level_file = file_name;
+    append(me.top_level_file, ".top");
+    me.technical_bins.clear();
+    for (uint64_t t = 0; t < technical_bins; ++t)
+    {
+        uint64_t remaining_technical_bins = technical_bins - t;
+        uint64_t target = (remaining_size + remaining_technical_bins - 1) / remaining_technical_bins;
+        // Every technical bin that is left needs at least one user bin.
+        uint64_t last = number_of_bins - (remaining_technical_bins - 1);
+        uint64_t load{0};
+        TechnicalBin technical_bin;
+        while (next < last && (technical_bin.user_bins.empty() || load + sizes[order[next]] <= target))
+        {
+            load += sizes[order[next]];
+            technical_bin.user_bins.push_back(order[next]);
+            ++next;
+        }
+        remaining_size -= load;
+        if (technical_bin.user_bins.size() > 1)
+        {
+            technical_bin.file_name = file_name;
+            append(technical_bin.file_name, ".group");
+            append(technical_bin.file_name, std::to_string(t));
+        }
+        me.technical_bins.push_back(technical_bin);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Function store()
+// ----------------------------------------------------------------------------
+
+inline void store(HierarchyManifest const & me, CharString const & file_name)
+{
+    auto relative = [] (CharString const & path) {
+        std::string file = toCString(path);
+        return file.substr(file.find_last_of('/') + 1);
+    };
+
+    std::ofstream out(toCString(file_name));
+    out << HIERARCHY_MANIFEST_HEADER << '\n' << me.number_of_bins << '\n' << relative(me.top_level_file) << '\n';
+    for (auto const & technical_bin : me.technical_bins)
+    {
+        out << (empty(technical_bin.file_name) ? std::string("-") : relative(technical_bin.file_name));
+        for (uint32_t user_bin : technical_bin.user_bins)
+            out << ' ' << user_bin;
+        out << '\n';
+    }
+    if (!out)
+        throw IOError("Unable to write hierarchy manifest: " + std::string(toCString(file_name)));
+}
+
+// ----------------------------------------------------------------------------
+// Function retrieve()
+// ----------------------------------------------------------------------------
+
+inline void retrieve(HierarchyManifest & me, CharString const & file_name)
+{
+    std::string manifest_file = toCString(file_name);
+    auto invalid = [&manifest_file] {
+        return IOError("File: " + manifest_file + " is not a valid hierarchy manifest!");
+    };
+
+    std::ifstream in(manifest_file);
+    std::string line;
+    std::string top_level_file;
+    if (!std::getline(in, line) || line != HIERARCHY_MANIFEST_HEADER || !(in >> me.number_of_bins >> top_level_file))
+        throw invalid();
+
+    std::string directory = manifest_file.substr(0, manifest_file.find_last_of('/') + 1);
+    me.top_level_file = directory + top_level_file;
+    me.technical_bins.clear();
+    std::vector<bool> covered(me.number_of_bins, false);
+    uint64_t number_covered{0};
+    std::getline(in, line);
+    while (std::getline(in, line))
+    {
+        if (line.empty())
+            continue;
+        std::istringstream fields(line);
+        std::string lower_level_file;
+        TechnicalBin technical_bin;
+        fields >> lower_level_file;
+        uint32_t user_bin;
+        while (fields >> user_bin)
+        {
+            if (user_bin >= me.number_of_bins || covered[user_bin])
+                throw invalid();
+            covered[user_bin] = true;
+            ++number_covered;
+            technical_bin.user_bins.push_back(user_bin);
+        }
+        if (technical_bin.user_bins.empty() || (lower_level_file == "-") != (technical_bin.user_bins.size() == 1))
+            throw invalid();
+        if (lower_level_file != "-")
+            technical_bin.file_name = directory + lower_level_file;
+        me.technical_bins.push_back(technical_bin);
+    }
+    if (number_covered != me.number_of_bins)
+        throw IOError("Hierarchy manifest " + manifest_file + " does not cover all bins.");
+}
+
+// ----------------------------------------------------------------------------
+// Class Hierarchy
+// ----------------------------------------------------------------------------
+// Read-only hierarchical filter, i.e. the top level and the lower levels of a
+// manifest written by build. It is constructed like an Ibf and queried by
+// select() with a HierarchySelector, whose masks have one bit per user bin.
+
+template <typename TValue, typename THashSpec>
+class HierarchySelector;
+
+template <typename TValue, typename THashSpec>
+class Hierarchy
+{
+public:
+    typedef Ibf<TValue, THashSpec>                  TIbf;
+    typedef typename TIbf::THash                    THash;
+    typedef HierarchySelector<TValue, THashSpec>    TSelector;
+
+    HierarchyManifest                   manifest;
+    std::unique_ptr<TIbf>               top_level;
+    // One filter per technical bin, null for the technical bins of a single user bin.
+    std::vector<std::unique_ptr<TIbf>>  lower_levels;
+
+    Hierarchy(CharString const & file_name, uint32_t window_size, bool use_mmap)
+    {
+        retrieve(manifest, file_name);
+        top_level.reset(new TIbf(manifest.top_level_file, window_size, use_mmap));
+        if (top_level->layout.number_of_bins != manifest.technical_bins.size())
+            throw IOError("The top-level filter does not match the hierarchy manifest " +
+                          std::string(toCString(file_name)) + ".");
+        for (auto const & technical_bin : manifest.technical_bins)
+        {
+            lower_levels.emplace_back();
+            if (empty(technical_bin.file_name))
+                continue;
+            lower_levels.back().reset(new TIbf(technical_bin.file_name, window_size, use_mmap));
+            IbfLayout const & layout = lower_levels.back()->layout;
+            // All levels share the minimizers of a query.
+            if (layout.number_of_bins != technical_bin.user_bins.size() ||
+                layout.kmer_size != top_level->layout.kmer_size ||
+                layout.window_size != top_level->layout.window_size)
+                throw IOError("The filter " + std::string(toCString(technical_bin.file_name)) +
+                              " does not match the hierarchy manifest " + std::string(toCString(file_name)) + ".");
+        }
+    }
+
+    Hierarchy(Hierarchy const &) = delete;
+    Hierarchy & operator=(Hierarchy const &) = delete;
+
+    THash hasher() const
+    {
+        return top_level->hasher();
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Function getKmerSize()
+// ----------------------------------------------------------------------------
+
+template <typename TValue, typename THashSpec>
+inline uint64_t getKmerSize(Hierarchy<TValue, THashSpec> const & me)
+{
+    return getKmerSize(*me.top_level);
+}
+
+// ----------------------------------------------------------------------------
+// Function getNumberOfBins()
+// ----------------------------------------------------------------------------
+
+template <typename TValue, typename THashSpec>
+inline uint64_t getNumberOfBins(Hierarchy<TValue, THashSpec> const & me)
+{
+    return me.manifest.number_of_bins;
+}
+
+// ----------------------------------------------------------------------------
+// Class HierarchySelector
+// ----------------------------------------------------------------------------
+// Per-thread state for select() on a Hierarchy. The minimizers of a query are
+// computed once and counted on the top level, then on the lower level of
+// every merged technical bin that passes the threshold. A merged technical
+// bin holds all minimizers of its user bins, so none of their hits is lost.
+// The selectors of the lower levels are created on first use.
+
+template <typename TValue, typename THashSpec>
+class HierarchySelector
+{
+public:
+    typedef Hierarchy<TValue, THashSpec>    THierarchy;
+    typedef IbfSelector<TValue, THashSpec>  TIbfSelector;
+
+    THierarchy const &                          hierarchy;
+    TIbfSelector                                top_level;
+    std::vector<std::unique_ptr<TIbfSelector>>  lower_levels;
+    typename THierarchy::THash                  hasher;
+    std::vector<uint64_t>                       kmer_hashes;
+    // One bit per user bin, set if the bin passes the threshold.
+    std::vector<uint64_t>                       mask;
+    StatsRecorder *                             stats;
+
+    HierarchySelector(THierarchy const & hierarchy, StatsRecorder * stats = nullptr) :
+        hierarchy(hierarchy),
+        top_level(*hierarchy.top_level, stats),
+        lower_levels(hierarchy.lower_levels.size()),
+        hasher(hierarchy.hasher()),
+        mask((hierarchy.manifest.number_of_bins + 63) / 64),
+        stats(stats) {}
+
+    // Sets mask to the user bins of the technical bins set in technical_mask that pass the threshold.
+    inline void descend(std::vector<uint64_t> const & technical_mask, std::vector<uint64_t> const & kmer_hashes,
+                        uint64_t threshold)
+    {
+        std::fill(mask.begin(), mask.end(), 0);
+        for_each_bin(technical_mask, [&] (uint64_t technical_bin) {
+            std::vector<uint32_t> const & user_bins = hierarchy.manifest.technical_bins[technical_bin].user_bins;
+            if (!hierarchy.lower_levels[technical_bin])
+            {
+                mask[user_bins[0] / 64] |= 1ULL << (user_bins[0] % 64);
+                return;
+            }
+            std::unique_ptr<TIbfSelector> & lower_level = lower_levels[technical_bin];
+            if (!lower_level)
+                lower_level.reset(new TIbfSelector(*hierarchy.lower_levels[technical_bin], stats));
+            for_each_bin(select_minimizers(*lower_level, kmer_hashes, threshold), [&] (uint64_t bin_number) {
+                mask[user_bins[bin_number] / 64] |= 1ULL << (user_bins[bin_number] % 64);
+            });
+        });
+    }
+
+    // True if technical_mask has a technical bin with a lower level.
+    inline bool has_lower_level(std::vector<uint64_t> const & technical_mask) const
+    {
+        bool found{false};
+        for_each_bin(technical_mask, [&] (uint64_t technical_bin) {
+            found |= static_cast<bool>(hierarchy.lower_levels[technical_bin]);
+        });
+        return found;
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Function select()
+// ----------------------------------------------------------------------------
+// User bins whose count reaches the threshold of thresholds for the length of
+// the text. The result stays valid until the next call with the same selector.
+
+template <typename TValue, typename THashSpec, typename TString>
+inline std::vector<uint64_t> const & select(HierarchySelector<TValue, THashSpec> & me, TString const & text,
+                                            ThresholdTable & thresholds)
+{
+    uint64_t threshold;
+    {
+        StageTimer timer(me.stats, STAGE_THRESHOLD, 1);
+        threshold = thresholds.get(me.hasher, length(text));
+    }
+    {
+        StageTimer timer(me.stats, STAGE_HASH);
+        me.hasher.getHash(text, me.kmer_hashes);
+        timer.add_items(me.kmer_hashes.size());
+    }
+    me.descend(select_minimizers(me.top_level, me.kmer_hashes, threshold), me.kmer_hashes, threshold);
+    return me.mask;
+}
+
+// ----------------------------------------------------------------------------
+// Function select_batch()
+// ----------------------------------------------------------------------------
+// select_batch() on the top level. The minimizers of a read are computed again
+// only if it reaches a lower level.
+
+template <typename TValue, typename THashSpec, typename TReads, typename TFunctor>
+inline void select_batch(HierarchySelector<TValue, THashSpec> & me, TReads const & reads, uint64_t first,
+                         uint64_t last, ThresholdTable & thresholds, TFunctor && f)
+{
+    select_batch(me.top_level, reads, first, last, thresholds, [&] (uint64_t r, std::vector<uint64_t> const & mask) {
+        if (!me.has_lower_level(mask))
+        {
+            me.descend(mask, me.kmer_hashes, 0);
+        }
+        else
+        {
+            uint64_t threshold;
+            {
+                StageTimer timer(me.stats, STAGE_THRESHOLD, 1);
+                threshold = thresholds.get(me.hasher, length(reads[r]));
+            }
+            {
+                StageTimer timer(me.stats, STAGE_HASH);
+                me.hasher.getHash(reads[r], me.kmer_hashes);
+                timer.add_items(me.kmer_hashes.size());
+            }
+            me.descend(mask, me.kmer_hashes, threshold);
+        }
+        f(r, me.mask);
+    });
+}
+
+#endif  // SRA_SEARCH_HIERARCHY_H_
@@ -0,0 +1,145 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#ifndef SRA_SEARCH_HYPERLOGLOG_H_
+#define SRA_SEARCH_HYPERLOGLOG_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "hash_mix.h"
+
+// ----------------------------------------------------------------------------
+// Class HyperLogLog
+// ----------------------------------------------------------------------------
+// Estimates the number of distinct 64 bit k-mer hashes in constant memory:
+// 2^precision one byte registers, with a relative standard error of about
+// 1.04 / sqrt(2^precision), i.e. 0.8% for the default of 14. Sketches of the
+// same precision can be merged, the merged sketch estimates the union. Not
+// thread-safe, every thread fills its own sketch.
+
+class HyperLogLog
+{
+public:
+    explicit HyperLogLog(uint8_t precision = 14) :
+        precision(precision),
+        registers(1ULL << precision, 0)
+    {
+        if (precision < 4 || precision > 18)
+            throw std::invalid_argument("The precision of a HyperLogLog sketch must be between 4 and 18.");
+    }
+
+    inline void insert(uint64_t key)
+    {
+        uint64_t hash = mix_hash(key);
+        uint64_t index = hash >> (64 - precision);
+        // The guard bit bounds the rank if all remaining bits are 0.
+        uint8_t rank = __builtin_clzll((hash << precision) | (1ULL << (precision - 1))) + 1;
+        registers[index] = std::max(registers[index], rank);
+    }
+
+    template <typename TIter>
+    inline void insert(TIter first, TIter last)
+    {
+        for (; first != last; ++first)
+            insert(*first);
+    }
+
+    void merge(HyperLogLog const & other)
+    {
+        check_precision(other);
+        for (size_t i = 0; i < registers.size(); ++i)
+            registers[i] = std::max(registers[i], other.registers[i]);
+    }
+
+    double estimate() const
+    {
+        return estimate([this] (size_t i) { return registers[i]; });
+    }
+
+    // Estimate of the union with other, without merging the sketches.
+    double union_estimate(HyperLogLog const & other) const
+    {
+        check_precision(other);
+        return estimate([this, &other] (size_t i) { return std::max(registers[i], other.registers[i]); });
+    }
+
+    void clear()
+    {
+        std::fill(registers.begin(), registers.end(), 0);
+    }
+
+private:
+    uint8_t                 precision;
+    std::vector<uint8_t>    registers;
+
+    void check_precision(HyperLogLog const & other) const
+    {
+        if (other.precision != precision)
+            throw std::invalid_argument("HyperLogLog sketches of different precision cannot be combined.");
+    }
+
+    // The raw estimate of Flajolet et al. with linear counting for small cardinalities. The 64 bit hashes make the
+    // correction for large cardinalities unnecessary.
+    template <typename TRegister>
+    double estimate(TRegister && reg) const
+    {
+        // Ranks are at most 65 - precision.
+        static double const * const inverse_powers = [] {
+            static double table[64];
+            for (int value = 0; value < 64; ++value)
+                table[value] = std::ldexp(1.0, -value);
+            return table;
+        }();
+        double const m = registers.size();
+        double sum{0};
+        uint64_t zeros{0};
+        for (size_t i = 0; i < registers.size(); ++i)
+        {
+            uint8_t value = reg(i);
+            sum += inverse_powers[value];
+            zeros += value == 0;
+        }
+        double const alpha = 0.7213 / (1 + 1.079 / m);
+        double raw = alpha * m * m / sum;
+        if (raw <= 2.5 * m && zeros != 0)
+            return m * std::log(m / zeros);
+        return raw;
+    }
+};
+
+#endif  // SRA_SEARCH_HYPERLOGLOG_H_
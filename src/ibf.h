@@ -0,0 +1,1194 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#ifndef SRA_SEARCH_IBF_H_
+#define SRA_SEARCH_IBF_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <seqan/binning_directory.h>
+
+#include "minimizer.h"
+#include "stats.h"
+#include "threshold.h"
+
+using namespace seqan;
+
+// ----------------------------------------------------------------------------
+// Enum FilterBackend
+// ----------------------------------------------------------------------------
+// How a filter maps a minimizer to its blocks. BACKEND_IBF hashes it to
+// number_of_hashes blocks of a bit vector of any size. BACKEND_DIRECT has one
+// block for every possible minimizer value (4^k), a lookup is a single access
+// and there are no false positives, which only pays off for small k.
+// BACKEND_BLOCKED is an IBF whose blocks are grouped into cache lines (or
+// pages for wide blocks): all hash functions of a minimizer select blocks of
+// the same group, so a lookup misses the cache once instead of
+// number_of_hashes times, at the price of a higher false positive rate.
+
+enum FilterBackend : uint64_t
+{
+    BACKEND_IBF = 0,
+    BACKEND_DIRECT = 1,
+    BACKEND_BLOCKED = 2
+};
+
+inline char const * backend_name(uint64_t backend)
+{
+    switch (backend)
+    {
+        case BACKEND_DIRECT:
+            return "direct";
+        case BACKEND_BLOCKED:
+            return "blocked";
+        default:
+            return "ibf";
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Function direct_filter_bits()
+// ----------------------------------------------------------------------------
+// Size of a direct-addressed filter without the metadata, the maximum value
+// if it does not fit into 64 bits.
+
+inline uint64_t direct_filter_bits(uint64_t number_of_bins, uint64_t kmer_size)
+{
+    unsigned __int128 bits = static_cast<unsigned __int128>(64 * ((number_of_bins + 63) / 64)) << (2 * kmer_size);
+    return bits >> 64 ? std::numeric_limits<uint64_t>::max() : static_cast<uint64_t>(bits);
+}
+
+// ----------------------------------------------------------------------------
+// Function choose_backend()
+// ----------------------------------------------------------------------------
+// The backend for the value of a --backend option (auto, ibf, direct or
+// blocked). auto takes direct addressing if it fits into the bits a filter may
+// use.
+
+inline uint64_t choose_backend(std::string const & choice, uint64_t number_of_bins, uint64_t kmer_size, uint64_t bits)
+{
+    if (choice == "auto")
+        return direct_filter_bits(number_of_bins, kmer_size) <= bits ? BACKEND_DIRECT : BACKEND_IBF;
+    if (choice == "blocked")
+        return BACKEND_BLOCKED;
+    return choice == "direct" ? BACKEND_DIRECT : BACKEND_IBF;
+}
+
+// ----------------------------------------------------------------------------
+// Class CacheAlignedAllocator
+// ----------------------------------------------------------------------------
+// Allocates the words of a filter at a cache line boundary, so that the groups
+// of the blocked backend do not straddle two cache lines.
+
+template <typename T>
+struct CacheAlignedAllocator
+{
+    typedef T value_type;
+
+    CacheAlignedAllocator() = default;
+
+    template <typename U>
+    CacheAlignedAllocator(CacheAlignedAllocator<U> const &) {}
+
+    T * allocate(size_t n)
+    {
+        void * memory{nullptr};
+        if (posix_memalign(&memory, 64, std::max<size_t>(1, n * sizeof(T))) != 0)
+            throw std::bad_alloc();
+        return static_cast<T *>(memory);
+    }
+
+    void deallocate(T * memory, size_t)
+    {
+        free(memory);
+    }
+};
+
+template <typename T, typename U>
+inline bool operator==(CacheAlignedAllocator<T> const &, CacheAlignedAllocator<U> const &)
+{
+    return true;
+}
+
+template <typename T, typename U>
+inline bool operator!=(CacheAlignedAllocator<T> const &, CacheAlignedAllocator<U> const &)
+{
+    return false;
+}
+
+typedef std::vector<uint64_t, CacheAlignedAllocator<uint64_t>> FilterWords;
+
+// ----------------------------------------------------------------------------
+// Class IbfLayout
+// ----------------------------------------------------------------------------
+// Describes how an InterleavedBloomFilter is laid out in the file written by
+// store(): an uncompressed sdsl::bit_vector, i.e. its length in bits as a
+// 64 bit integer followed by the 64 bit words. The last 256 bits of the vector
+// hold the metadata (number of bins, number of hash functions, k-mer size and
+// window size, the latter is 0 for filters that do not record it). The upper
+// 32 bits of the window size word hold the backend, 0 for older filters, the
+// upper 32 bits of the number of hash functions the blocks per group of the
+// blocked backend. Every hash function selects a block of bin_width words,
+// bit b of a block belongs to bin b.
+
+struct IbfLayout
+{
+    static const uint64_t metadata_bits{256};
+    static const uint64_t shift_value{27};
+    static const uint64_t seed_value{0x90b45d39fb6da1faULL};
+    static const uint64_t group_seed_value{0x5bd1e9955bd1e995ULL};
+
+    uint64_t                number_of_bins;
+    uint64_t                number_of_hashes;
+    uint64_t                kmer_size;
+    uint64_t                window_size;
+    uint64_t                backend;
+    uint64_t                bits;
+    uint64_t                bin_width;
+    uint64_t                block_bits;
+    uint64_t                blocks;
+    // Consecutive blocks that all hash functions of a minimizer share, 1 except for the blocked backend.
+    uint64_t                group_blocks;
+    uint64_t                groups;
+    std::vector<uint64_t>   pre_calc;
+    // Replace the division by groups, see modulo_groups().
+    uint64_t                group_magic;
+    uint64_t                group_shift;
+
+    IbfLayout() :
+        number_of_bins(0),
+        number_of_hashes(0),
+        kmer_size(0),
+        window_size(0),
+        backend(BACKEND_IBF),
+        bits(0),
+        bin_width(0),
+        block_bits(0),
+        blocks(0),
+        group_blocks(0),
+        groups(0),
+        group_magic(0),
+        group_shift(0) {}
+
+    // group_blocks 0 takes the default of the blocked backend, see default_group_blocks().
+    IbfLayout(uint64_t number_of_bins, uint64_t number_of_hashes, uint64_t kmer_size, uint64_t window_size,
+              uint64_t bits, uint64_t backend = BACKEND_IBF, uint64_t group_blocks = 0) :
+        number_of_bins(number_of_bins),
+        number_of_hashes(number_of_hashes),
+        kmer_size(kmer_size),
+        window_size(window_size),
+        backend(backend),
+        bits(bits),
+        group_blocks(group_blocks)
+    {
+        init();
+    }
+
+    // Blocks per group of the blocked backend for groups of group_bytes, e.g. a 64 byte cache line or a 4 KiB page,
+    // but at least two blocks. A cache line holds only a few bits of every bin, which raises the false positive rate
+    // much more than a page, which in turn only saves the TLB misses.
+    static uint64_t default_group_blocks(uint64_t bin_width, uint64_t group_bytes = 64)
+    {
+        return std::max<uint64_t>(2, group_bytes / (8 * bin_width));
+    }
+
+    void init()
+    {
+        // A direct-addressed filter has exactly one block per minimizer.
+        if (backend == BACKEND_DIRECT)
+            number_of_hashes = 1;
+        bin_width = (number_of_bins + 63) / 64;
+        block_bits = bin_width * 64;
+        blocks = bits / block_bits;
+        if (backend == BACKEND_BLOCKED)
+        {
+            if (group_blocks == 0)
+                group_blocks = default_group_blocks(bin_width);
+            // Blocks beyond the last full group are not used.
+            groups = blocks / group_blocks;
+        }
+        else
+        {
+            group_blocks = 1;
+            groups = blocks;
+        }
+        // Smallest l with 2^l >= groups, magic is floor(2^(64 + l) / groups) + 1 without its 65th bit.
+        uint64_t l{0};
+        while (l < 63 && (1ULL << l) < groups)
+            ++l;
+        group_shift = l ? l - 1 : 0;
+        group_magic = groups > 1 ? static_cast<uint64_t>(((static_cast<unsigned __int128>(1) << (64 + l)) / groups) + 1) : 0;
+        pre_calc.resize(number_of_hashes);
+        for (uint64_t i = 0; i < number_of_hashes; ++i)
+            pre_calc[i] = i ^ (kmer_size * seed_value);
+    }
+
+    // Number of 64 bit words of the bit vector including the metadata.
+    uint64_t words() const
+    {
+        return (bits + metadata_bits + 63) / 64;
+    }
+
+    // Word offset of the block that the i-th hash function assigns to a k-mer hash.
+    inline uint64_t block_word(uint64_t kmer_hash, uint64_t i) const
+    {
+        if (backend == BACKEND_DIRECT)
+            return kmer_hash * bin_width;
+        if (backend == BACKEND_BLOCKED)
+        {
+            // The first hash function selects the group. The blocks in it are taken from 12 bit slices of a second,
+            // well mixed hash (splitmix64), the multiplicative hash differs too little between hash functions.
+            uint64_t index = pre_calc[0] * kmer_hash;
+            index ^= index >> shift_value;
+            uint64_t mixed = kmer_hash + group_seed_value;
+            mixed = (mixed ^ (mixed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            mixed = (mixed ^ (mixed >> 27)) * 0x94d049bb133111ebULL;
+            mixed ^= mixed >> 31;
+            uint64_t offset = ((mixed >> (12 * i)) & 0xFFF) * group_blocks >> 12;
+            return (modulo_groups(index) * group_blocks + offset) * bin_width;
+        }
+        uint64_t index = pre_calc[i] * kmer_hash;
+        index ^= index >> shift_value;
+        return modulo_groups(index) * bin_width;
+    }
+
+    // index % groups by multiplying with the precomputed inverse (Granlund and
+    // Montgomery), a division would dominate the cost of a lookup.
+    inline uint64_t modulo_groups(uint64_t index) const
+    {
+        if (groups <= 1)
+            return 0;
+        uint64_t high = static_cast<uint64_t>((static_cast<unsigned __int128>(index) * group_magic) >> 64);
+        uint64_t quotient = (high + ((index - high) >> 1)) >> group_shift;
+        return index - quotient * groups;
+    }
+
+    void read_metadata(uint64_t const * words, uint64_t vector_bits)
+    {
+        if (vector_bits < metadata_bits)
+            throw IOError("Filter file is too small to hold the filter metadata.");
+        bits = vector_bits - metadata_bits;
+        decode_metadata(words + bits / 64);
+    }
+
+    // Sets the fields from the metadata words, bits must be set already.
+    void decode_metadata(uint64_t const * metadata)
+    {
+        number_of_bins = metadata[0];
+        number_of_hashes = metadata[1] & 0xFFFFFFFFULL;
+        group_blocks = metadata[1] >> 32;
+        kmer_size = metadata[2];
+        window_size = metadata[3] & 0xFFFFFFFFULL;
+        backend = metadata[3] >> 32;
+        init();
+        if (backend > BACKEND_BLOCKED)
+            throw IOError("The filter uses an unknown backend (" + std::to_string(backend) + ").");
+        if (backend == BACKEND_DIRECT && bits != direct_filter_bits(number_of_bins, kmer_size))
+            throw IOError("The direct-addressed filter does not have a block for every k-mer.");
+    }
+
+    void write_metadata(uint64_t * words) const
+    {
+        encode_metadata(words + bits / 64);
+    }
+
+    // Writes the metadata_bits / 64 metadata words.
+    void encode_metadata(uint64_t * metadata) const
+    {
+        metadata[0] = number_of_bins;
+        metadata[1] = number_of_hashes | (backend == BACKEND_BLOCKED ? group_blocks << 32 : 0);
+        metadata[2] = kmer_size;
+        metadata[3] = window_size | backend << 32;
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Function false_positive_rate()
+// ----------------------------------------------------------------------------
+// Probability that a lookup of a minimizer reports a bin of the given number
+// of distinct minimizers that does not contain it. For the blocked backend the
+// number of minimizers per group is Poisson distributed and the rate is
+// averaged over it, the hash functions of a minimizer may share a block.
+
+inline double false_positive_rate(IbfLayout const & layout, double elements)
+{
+    double const hashes = layout.number_of_hashes;
+    if (layout.backend == BACKEND_DIRECT || elements <= 0)
+        return 0;
+    if (layout.groups == 0)
+        return 1;
+    if (layout.backend != BACKEND_BLOCKED)
+        return std::pow(1 - std::exp(-hashes * elements / layout.blocks), hashes);
+
+    double const lambda = elements / layout.groups;
+    double const deviation = std::sqrt(lambda);
+    double const miss = 1 - 1.0 / layout.group_blocks;
+    double rate{0};
+    for (double j = std::max(0.0, std::floor(lambda - 12 * deviation - 12)); j <= lambda + 12 * deviation + 12; ++j)
+    {
+        double const probability = std::exp(j * std::log(lambda) - lambda - std::lgamma(j + 1));
+        rate += probability * std::pow(1 - std::pow(miss, hashes * j), hashes);
+    }
+    return std::min(rate, 1.0);
+}
+
+// ----------------------------------------------------------------------------
+// Function fpr_layout()
+// ----------------------------------------------------------------------------
+// The smallest layout of the backend (auto, ibf, blocked or direct) for which
+// a bin of the given number of distinct minimizers has a false positive rate
+// of at most fpr, trying 2 to 5 hash functions. The direct backend has a fixed
+// size and no false positives, auto takes it if it is not larger than ibf.
+
+inline IbfLayout fpr_layout(std::string const & backend, uint64_t number_of_bins, uint64_t kmer_size,
+                            uint64_t window_size, uint64_t group_bytes, double elements, double fpr)
+{
+    uint64_t const direct_bits = direct_filter_bits(number_of_bins, kmer_size);
+    if (backend == "direct")
+        return IbfLayout(number_of_bins, 1, kmer_size, window_size, direct_bits, BACKEND_DIRECT);
+
+    uint64_t const filter_backend = backend == "blocked" ? BACKEND_BLOCKED : BACKEND_IBF;
+    uint64_t const bin_width = (number_of_bins + 63) / 64;
+    uint64_t const group_blocks = filter_backend == BACKEND_BLOCKED ?
+                                  IbfLayout::default_group_blocks(bin_width, group_bytes) : 1;
+    uint64_t const group_bits = group_blocks * bin_width * 64;
+    // 2^50 bits are 128 TiB, no larger filter is of any use.
+    uint64_t const max_groups = std::max<uint64_t>(1, (1ULL << 50) / group_bits);
+    auto meets_fpr = [&] (uint64_t hashes, uint64_t groups) {
+        IbfLayout layout(number_of_bins, hashes, kmer_size, window_size, groups * group_bits, filter_backend,
+                         group_blocks);
+        return false_positive_rate(layout, elements) <= fpr;
+    };
+
+    uint64_t best_hashes{0};
+    uint64_t best_groups{max_groups + 1};
+    for (uint64_t hashes = 2; hashes <= 5; ++hashes)
+    {
+        // The rate falls with the number of groups, find the smallest one by doubling and bisection.
+        uint64_t high{1};
+        while (high < max_groups && !meets_fpr(hashes, high))
+            high = std::min(2 * high, max_groups);
+        if (!meets_fpr(hashes, high))
+            continue;
+        uint64_t low = high / 2;
+        while (high - low > 1)
+        {
+            uint64_t middle = low + (high - low) / 2;
+            if (meets_fpr(hashes, middle))
+                high = middle;
+            else
+                low = middle;
+        }
+        if (high < best_groups)
+        {
+            best_hashes = hashes;
+            best_groups = high;
+        }
+    }
+    if (best_hashes == 0)
+        throw RuntimeError("No filter of at most 128 TiB reaches a false positive rate of " + std::to_string(fpr) + ".");
+    if (backend == "auto" && direct_bits <= best_groups * group_bits)
+        return IbfLayout(number_of_bins, 1, kmer_size, window_size, direct_bits, BACKEND_DIRECT);
+    return IbfLayout(number_of_bins, best_hashes, kmer_size, window_size, best_groups * group_bits, filter_backend,
+                     group_blocks);
+}
+
+// ----------------------------------------------------------------------------
+// Function read_layout()
+// ----------------------------------------------------------------------------
+// Reads only the metadata of a stored filter.
+
+inline IbfLayout read_layout(CharString const & file_name)
+{
+    std::ifstream in(toCString(file_name), std::ios::binary | std::ios::ate);
+    if (!in)
+        throw IOError("Unable to open filter file: " + std::string(toCString(file_name)));
+    uint64_t file_size = in.tellg();
+    uint64_t vector_bits{0};
+    in.seekg(0);
+    in.read(reinterpret_cast<char *>(&vector_bits), sizeof(vector_bits));
+    if (!in || vector_bits < IbfLayout::metadata_bits || vector_bits % 64 != 0 ||
+        file_size < sizeof(uint64_t) * (1 + vector_bits / 64))
+        throw IOError("File: " + std::string(toCString(file_name)) + " is not a valid filter!");
+
+    uint64_t metadata[IbfLayout::metadata_bits / 64];
+    in.seekg(sizeof(uint64_t) * (1 + (vector_bits - IbfLayout::metadata_bits) / 64));
+    in.read(reinterpret_cast<char *>(metadata), sizeof(metadata));
+
+    IbfLayout layout;
+    layout.bits = vector_bits - IbfLayout::metadata_bits;
+    layout.decode_metadata(metadata);
+    return layout;
+}
+
+// ----------------------------------------------------------------------------
+// Function check_window_size()
+// ----------------------------------------------------------------------------
+// The window size to query a filter with: the one of the filter if
+// window_size is 0 (24 for filters that do not record it), otherwise
+// window_size, which must match the one of the filter.
+
+inline uint32_t check_window_size(uint32_t window_size, IbfLayout const & layout)
+{
+    if (window_size == 0)
+        return layout.window_size ? layout.window_size : 24;
+    if (layout.window_size != 0 && layout.window_size != window_size)
+        throw RuntimeError("The filter was built with window size " + std::to_string(layout.window_size) +
+                           ", not " + std::to_string(window_size) + ".");
+    return window_size;
+}
+
+// ----------------------------------------------------------------------------
+// Function read_words()
+// ----------------------------------------------------------------------------
+// Reads the words of a stored filter into memory and returns its layout.
+
+inline IbfLayout read_words(FilterWords & words, CharString const & file_name)
+{
+    std::ifstream in(toCString(file_name), std::ios::binary | std::ios::ate);
+    if (!in)
+        throw IOError("Unable to open filter file: " + std::string(toCString(file_name)));
+    uint64_t file_size = in.tellg();
+    uint64_t vector_bits{0};
+    in.seekg(0);
+    in.read(reinterpret_cast<char *>(&vector_bits), sizeof(vector_bits));
+    if (!in || vector_bits < IbfLayout::metadata_bits || file_size < sizeof(uint64_t) * (1 + (vector_bits + 63) / 64))
+        throw IOError("File: " + std::string(toCString(file_name)) + " is not a valid filter!");
+    words.resize((vector_bits + 63) / 64);
+    in.read(reinterpret_cast<char *>(words.data()), words.size() * sizeof(uint64_t));
+
+    IbfLayout layout;
+    layout.read_metadata(words.data(), vector_bits);
+    return layout;
+}
+
+// ----------------------------------------------------------------------------
+// Class IbfBuilder
+// ----------------------------------------------------------------------------
+// Builds an InterleavedBloomFilter from many threads. Neighbouring bins share
+// the words of a block, so threads must never set bits in the same word
+// concurrently. Instead, every thread owns an Inserter that buffers the bit
+// positions per region of the bit vector (a range of whole blocks) and applies
+// a full buffer while holding the lock of that region only. Threads therefore
+// only wait for each other if they flush the same region at the same time.
+
+class IbfBuilder
+{
+public:
+    IbfLayout               layout;
+    FilterWords             words;
+
+    // A direct-addressed filter ignores bits, it always has 4^k blocks. group_blocks is only used by the blocked
+    // backend, 0 selects cache line groups.
+    IbfBuilder(uint64_t number_of_bins, uint64_t number_of_hashes, uint64_t kmer_size, uint64_t window_size,
+               uint64_t bits, unsigned threads, uint64_t backend = BACKEND_IBF, uint64_t group_blocks = 0) :
+        // The metadata has to start at a word boundary.
+        layout(number_of_bins, number_of_hashes, kmer_size, window_size,
+               backend == BACKEND_DIRECT ? direct_filter_bits(number_of_bins, kmer_size) : bits - bits % 64, backend,
+               group_blocks),
+        words(layout.words(), 0),
+        threads(std::max(1u, threads))
+    {
+        if (layout.groups == 0)
+        {
+            throw RuntimeError("The filter size is too small for " + std::to_string(number_of_bins) + " bins!");
+        }
+        if (layout.bits == std::numeric_limits<uint64_t>::max())
+        {
+            throw RuntimeError("A direct-addressed filter for k = " + std::to_string(kmer_size) + " is too large!");
+        }
+        init_regions();
+    }
+
+    // Continues building a stored filter.
+    IbfBuilder(CharString const & file_name, unsigned threads) :
+        threads(std::max(1u, threads))
+    {
+        layout = read_words(words, file_name);
+        init_regions();
+    }
+
+    // Grows the number of bins. Bins that fit into the unused bits of the last word of a block are free, otherwise
+    // every block gets wider. The number of blocks stays the same, so all k-mers keep their blocks.
+    void resize_bins(uint64_t number_of_bins)
+    {
+        if (number_of_bins <= layout.number_of_bins)
+            return;
+
+        // The blocked backend keeps its blocks per group, so that the minimizers keep their groups.
+        IbfLayout wider(number_of_bins, layout.number_of_hashes, layout.kmer_size, layout.window_size, 0,
+                        layout.backend, layout.group_blocks);
+        wider.bits = layout.blocks * wider.block_bits;
+        wider.init();
+        if (wider.bin_width != layout.bin_width)
+        {
+            FilterWords wider_words(wider.words(), 0);
+            for (uint64_t block = 0; block < layout.blocks; ++block)
+                std::copy(words.begin() + block * layout.bin_width,
+                          words.begin() + (block + 1) * layout.bin_width,
+                          wider_words.begin() + block * wider.bin_width);
+            words.swap(wider_words);
+        }
+        else
+        {
+            wider.bits = layout.bits;
+            wider.init();
+        }
+        layout = wider;
+    }
+
+    // Removes all k-mers of the given bins.
+    void clear_bins(std::vector<uint32_t> const & bins)
+    {
+        std::vector<uint64_t> keep(layout.bin_width, ~0ULL);
+        for (uint32_t bin_number : bins)
+            keep[bin_number / 64] &= ~(1ULL << (bin_number % 64));
+
+        uint64_t batch_size = (layout.blocks + threads - 1) / threads;
+        std::vector<std::future<void>> tasks;
+        for (uint64_t first_block = 0; first_block < layout.blocks; first_block += batch_size)
+        {
+            tasks.emplace_back(std::async(std::launch::async, [&, first_block] {
+                uint64_t last_block = std::min(layout.blocks, first_block + batch_size);
+                for (uint64_t word = first_block * layout.bin_width; word < last_block * layout.bin_width; ++word)
+                    words[word] &= keep[word % layout.bin_width];
+            }));
+        }
+        for (auto &&task : tasks)
+            task.get();
+    }
+
+    class Inserter
+    {
+    public:
+        explicit Inserter(IbfBuilder & builder) :
+            builder(builder),
+            buffers(builder.number_of_regions),
+            // Keep about 2^21 buffered positions (16 MiB) per thread.
+            capacity(std::max<uint64_t>(64, (1ULL << 21) / builder.number_of_regions)) {}
+
+        Inserter(Inserter const &) = delete;
+        Inserter & operator=(Inserter const &) = delete;
+
+        ~Inserter()
+        {
+            flush();
+        }
+
+        inline void insert(uint64_t kmer_hash, uint64_t bin_number)
+        {
+            IbfLayout const & layout = builder.layout;
+            for (uint64_t i = 0; i < layout.number_of_hashes; ++i)
+            {
+                uint64_t block_word = layout.block_word(kmer_hash, i);
+                uint64_t region = block_word / layout.bin_width / builder.blocks_per_region;
+                std::vector<uint64_t> & buffer = buffers[region];
+                buffer.push_back(block_word * 64 + bin_number);
+                if (buffer.size() >= capacity)
+                    builder.apply(region, buffer);
+            }
+        }
+
+        void flush()
+        {
+            for (uint64_t region = 0; region < buffers.size(); ++region)
+                if (!buffers[region].empty())
+                    builder.apply(region, buffers[region]);
+        }
+
+    private:
+        IbfBuilder &                        builder;
+        std::vector<std::vector<uint64_t>>  buffers;
+        uint64_t                            capacity;
+    };
+
+private:
+    unsigned                        threads;
+    uint64_t                        blocks_per_region;
+    uint64_t                        number_of_regions;
+    std::unique_ptr<std::mutex[]>   region_mtx;
+
+    void init_regions()
+    {
+        uint64_t regions = std::min<uint64_t>(layout.blocks, 64 * threads);
+        blocks_per_region = (layout.blocks + regions - 1) / regions;
+        number_of_regions = (layout.blocks + blocks_per_region - 1) / blocks_per_region;
+        region_mtx.reset(new std::mutex[number_of_regions]);
+    }
+
+    void apply(uint64_t region, std::vector<uint64_t> & positions)
+    {
+        std::lock_guard<std::mutex> lock(region_mtx[region]);
+        for (uint64_t position : positions)
+            words[position / 64] |= 1ULL << (position % 64);
+        positions.clear();
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Function store()
+// ----------------------------------------------------------------------------
+// Writes the filter in the format of store() for a BinningDirectory.
+
+inline void store(IbfBuilder & me, CharString const & file_name)
+{
+    IbfLayout const & layout = me.layout;
+    layout.write_metadata(me.words.data());
+
+    std::ofstream out(toCString(file_name), std::ios::binary);
+    uint64_t vector_bits = layout.bits + IbfLayout::metadata_bits;
+    out.write(reinterpret_cast<char const *>(&vector_bits), sizeof(vector_bits));
+    out.write(reinterpret_cast<char const *>(me.words.data()), me.words.size() * sizeof(uint64_t));
+    if (!out)
+    {
+        throw IOError("Unable to write filter file: " + std::string(toCString(file_name)));
+    }
+}
+
+template <typename TValue, typename THashSpec>
+class IbfSelector;
+
+// ----------------------------------------------------------------------------
+// Class Ibf
+// ----------------------------------------------------------------------------
+// Read-only InterleavedBloomFilter that is queried directly on the words of a
+// stored filter. A window_size other than 0 replaces the one recorded in the
+// filter, which is needed for filters that do not record it. The words are
+// either read into memory or, with use_mmap, the file is mapped and shared
+// via the page cache between all processes using it. A mapped filter starts
+// one word after a page boundary, so the groups of the blocked backend
+// straddle two cache lines; read it into memory to avoid that.
+
+template <typename TValue, typename THashSpec>
+class Ibf
+{
+public:
+    typedef MinimizerHash<TValue, THashSpec> THash;
+    typedef IbfSelector<TValue, THashSpec>   TSelector;
+
+    IbfLayout               layout;
+
+    Ibf(CharString const & file_name, uint32_t window_size, bool use_mmap) :
+        words(nullptr),
+        mapping(MAP_FAILED),
+        mapping_size(0)
+    {
+        if (use_mmap)
+            map_file(file_name);
+        else
+            read_file(file_name);
+        if (window_size != 0)
+            layout.window_size = window_size;
+    }
+
+    // Queries the words of a filter that is still held by a builder, which must outlive the Ibf.
+    explicit Ibf(IbfBuilder const & builder) :
+        layout(builder.layout),
+        words(builder.words.data()),
+        mapping(MAP_FAILED),
+        mapping_size(0) {}
+
+    Ibf(Ibf const &) = delete;
+    Ibf & operator=(Ibf const &) = delete;
+
+    ~Ibf()
+    {
+        if (mapping != MAP_FAILED)
+            munmap(mapping, mapping_size);
+    }
+
+    uint64_t const * data() const
+    {
+        return words;
+    }
+
+    THash hasher() const
+    {
+        THash hash;
+        hash.resize(layout.kmer_size, layout.window_size);
+        return hash;
+    }
+
+private:
+    uint64_t const *        words;
+    void *                  mapping;
+    size_t                  mapping_size;
+
+    void check_size(CharString const & file_name, uint64_t vector_bits, uint64_t file_size)
+    {
+        if (vector_bits < IbfLayout::metadata_bits || file_size < sizeof(uint64_t) * (1 + (vector_bits + 63) / 64))
+        {
+            throw IOError("File: " + std::string(toCString(file_name)) + " is not a valid filter!");
+        }
+    }
+
+    // Reads the words into anonymous memory backed by huge pages if the system
+    // allows it. Every lookup is a random access, with 4 KiB pages nearly every
+    // one of them also misses the TLB.
+    void read_file(CharString const & file_name)
+    {
+        layout = read_layout(file_name);
+        mapping_size = layout.words() * sizeof(uint64_t);
+        mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED)
+            throw IOError("Unable to allocate memory for filter file: " + std::string(toCString(file_name)));
+#ifdef MADV_HUGEPAGE
+        madvise(mapping, mapping_size, MADV_HUGEPAGE);
+#endif
+        std::ifstream in(toCString(file_name), std::ios::binary);
+        in.seekg(sizeof(uint64_t));
+        in.read(static_cast<char *>(mapping), mapping_size);
+        if (!in)
+        {
+            munmap(mapping, mapping_size);
+            mapping = MAP_FAILED;
+            throw IOError("Unable to read filter file: " + std::string(toCString(file_name)));
+        }
+        words = static_cast<uint64_t const *>(mapping);
+    }
+
+    void map_file(CharString const & file_name)
+    {
+        int fd = ::open(toCString(file_name), O_RDONLY);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) == -1)
+        {
+            if (fd != -1)
+                ::close(fd);
+            throw IOError("Unable to open filter file: " + std::string(toCString(file_name)));
+        }
+        mapping_size = st.st_size;
+        mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            throw IOError("Unable to map filter file: " + std::string(toCString(file_name)));
+        }
+        // Lookups jump around the whole filter, read-ahead would only pollute the page cache.
+        madvise(mapping, mapping_size, MADV_RANDOM);
+
+        uint64_t const * file_words = static_cast<uint64_t const *>(mapping);
+        check_size(file_name, mapping_size >= sizeof(uint64_t) ? file_words[0] : 0, mapping_size);
+        words = file_words + 1;
+        layout.read_metadata(words, file_words[0]);
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Function getKmerSize()
+// ----------------------------------------------------------------------------
+
+template <typename TValue, typename THashSpec>
+inline uint64_t getKmerSize(Ibf<TValue, THashSpec> const & me)
+{
+    return me.layout.kmer_size;
+}
+
+// ----------------------------------------------------------------------------
+// Function getNumberOfBins()
+// ----------------------------------------------------------------------------
+
+template <typename TValue, typename THashSpec>
+inline uint64_t getNumberOfBins(Ibf<TValue, THashSpec> const & me)
+{
+    return me.layout.number_of_bins;
+}
+
+// ----------------------------------------------------------------------------
+// Function count()
+// ----------------------------------------------------------------------------
+// Number of minimizers of text that each bin contains.
+
+template <typename TValue, typename THashSpec, typename TString>
+inline std::vector<uint16_t> count(Ibf<TValue, THashSpec> const & me, TString const & text)
+{
+    IbfLayout const & layout = me.layout;
+    uint64_t const * words = me.data();
+    std::vector<uint16_t> counts(layout.number_of_bins, 0);
+    std::vector<uint64_t> block_words(layout.number_of_hashes);
+
+    auto hasher = me.hasher();
+    for (uint64_t kmer_hash : hasher.getHash(text))
+    {
+        for (uint64_t i = 0; i < layout.number_of_hashes; ++i)
+            block_words[i] = layout.block_word(kmer_hash, i);
+
+        for (uint64_t w = 0; w < layout.bin_width; ++w)
+        {
+            uint64_t tmp = words[block_words[0] + w];
+            for (uint64_t i = 1; i < layout.number_of_hashes; ++i)
+                tmp &= words[block_words[i] + w];
+
+            uint64_t bin_number = w * 64;
+            while (tmp > 0)
+            {
+                uint64_t step = __builtin_ctzll(tmp);
+                bin_number += step;
+                ++counts[bin_number];
+                ++bin_number;
+                tmp = (step == 63) ? 0 : tmp >> (step + 1);
+            }
+        }
+    }
+    return counts;
+}
+
+// ----------------------------------------------------------------------------
+// Class IbfSelector
+// ----------------------------------------------------------------------------
+// Per-thread state for select() on an Ibf. The hit counters of all bins are
+// bit-sliced: counter bit j of the bins of word w is bit w of plane j, i.e.
+// planes[j * bin_width + w]. Adding the AND of the hash blocks of a
+// minimizer is a ripple-carry add of whole words over the planes, and the
+// threshold compare is done on the planes as well, so a query costs
+// operations per word of 64 bins instead of per bin. The loops run over the
+// words of all planes and are vectorized by the compiler for wide filters.
+
+template <typename TValue, typename THashSpec>
+class IbfSelector
+{
+public:
+    typedef Ibf<TValue, THashSpec> TIbf;
+
+    TIbf const &                        ibf;
+    typename TIbf::THash                hasher;
+    std::vector<uint64_t>               kmer_hashes;
+    // Consecutive windows often share their minimizer. Every run of equal
+    // minimizers is looked up once: offsets holds the word offsets of its
+    // blocks, number_of_hashes per run, and multiplicities its length.
+    std::vector<uint64_t>               offsets;
+    std::vector<uint64_t>               multiplicities;
+    // End of the runs and number of windows of each read of a batch, see select_batch().
+    std::vector<uint64_t>               read_ends;
+    std::vector<uint64_t>               read_windows;
+    std::vector<uint64_t>               thresholds;
+    std::vector<uint64_t>               block;
+    std::vector<uint64_t>               carry;
+    std::vector<uint64_t>               planes;
+    // One bit per bin, set if the bin passes the threshold.
+    std::vector<uint64_t>               mask;
+    uint64_t                            number_of_planes;
+    // Records the threshold, hash and lookup stages if set.
+    StatsRecorder *                     stats;
+
+    IbfSelector(TIbf const & ibf, StatsRecorder * stats = nullptr) :
+        ibf(ibf),
+        hasher(ibf.hasher()),
+        block(ibf.layout.bin_width),
+        carry(ibf.layout.bin_width),
+        mask(ibf.layout.bin_width),
+        number_of_planes(0),
+        stats(stats) {}
+
+    // Clears the counters and makes them wide enough for up to max_count hits.
+    inline void reset(uint64_t max_count)
+    {
+        number_of_planes = 1;
+        while (number_of_planes < 64 && (max_count >> number_of_planes) != 0)
+            ++number_of_planes;
+        planes.assign(number_of_planes * ibf.layout.bin_width, 0);
+    }
+
+    // Appends the runs of equal minimizers in kmer_hashes to offsets and multiplicities.
+    inline void locate(std::vector<uint64_t> const & kmer_hashes)
+    {
+        for (uint64_t m = 0; m < kmer_hashes.size();)
+        {
+            uint64_t run_end = m + 1;
+            while (run_end < kmer_hashes.size() && kmer_hashes[run_end] == kmer_hashes[m])
+                ++run_end;
+            for (uint64_t i = 0; i < ibf.layout.number_of_hashes; ++i)
+                offsets.push_back(ibf.layout.block_word(kmer_hashes[m], i));
+            multiplicities.push_back(run_end - m);
+            m = run_end;
+        }
+    }
+
+    // Asks the CPU to load the blocks at block_offsets into the cache.
+    inline void prefetch(uint64_t const * block_offsets) const
+    {
+        uint64_t const * words = ibf.data();
+        uint64_t const last = ibf.layout.bin_width - 1;
+        for (uint64_t i = 0; i < ibf.layout.number_of_hashes; ++i)
+        {
+            // A block may start in the middle of a cache line.
+            for (uint64_t w = 0; w < last; w += 8)
+                __builtin_prefetch(words + block_offsets[i] + w);
+            __builtin_prefetch(words + block_offsets[i] + last);
+        }
+    }
+
+    // Adds multiplicity to the counters of all bins whose blocks at block_offsets are all set.
+    inline void add(uint64_t const * block_offsets, uint64_t multiplicity)
+    {
+        IbfLayout const & layout = ibf.layout;
+        uint64_t const * words = ibf.data();
+        uint64_t const bin_width = layout.bin_width;
+
+        uint64_t const * first = words + block_offsets[0];
+        for (uint64_t w = 0; w < bin_width; ++w)
+            block[w] = first[w];
+        for (uint64_t i = 1; i < layout.number_of_hashes; ++i)
+        {
+            uint64_t const * other = words + block_offsets[i];
+            for (uint64_t w = 0; w < bin_width; ++w)
+                block[w] &= other[w];
+        }
+
+        uint64_t occupied{0};
+        for (uint64_t w = 0; w < bin_width; ++w)
+            occupied |= block[w];
+        if (occupied == 0)
+            return;
+
+        // Plane j adds bit j of multiplicity for the bins of the block.
+        uint64_t * plane = planes.data();
+        uint64_t * c = carry.data();
+        for (uint64_t w = 0; w < bin_width; ++w)
+            c[w] = 0;
+        for (uint64_t j = 0; j < number_of_planes; ++j, plane += bin_width)
+        {
+            uint64_t const bit = 0ULL - ((multiplicity >> j) & 1);
+            uint64_t pending{0};
+            for (uint64_t w = 0; w < bin_width; ++w)
+            {
+                uint64_t const addend = block[w] & bit;
+                uint64_t const half = plane[w] ^ addend;
+                uint64_t const next = (plane[w] & addend) | (half & c[w]);
+                plane[w] = half ^ c[w];
+                c[w] = next;
+                pending |= next;
+            }
+            if (pending == 0 && (j + 1 >= 64 || (multiplicity >> (j + 1)) == 0))
+                break;
+        }
+    }
+
+    // Sets mask to the bins whose counter is at least threshold. Compares the
+    // planes from the most significant one down: a counter is greater than the
+    // threshold as soon as it has a bit the threshold lacks while all higher
+    // bits were equal.
+    inline void compare(uint64_t threshold)
+    {
+        uint64_t const bin_width = ibf.layout.bin_width;
+        if (number_of_planes < 64 && (threshold >> number_of_planes) != 0)
+        {
+            std::fill(mask.begin(), mask.end(), 0);
+            return;
+        }
+
+        uint64_t * greater = mask.data();
+        uint64_t * equal = carry.data();
+        for (uint64_t w = 0; w < bin_width; ++w)
+        {
+            greater[w] = 0;
+            equal[w] = ~0ULL;
+        }
+        for (uint64_t j = number_of_planes; j-- > 0;)
+        {
+            uint64_t const * plane = planes.data() + j * bin_width;
+            if ((threshold >> j) & 1)
+            {
+                for (uint64_t w = 0; w < bin_width; ++w)
+                    equal[w] &= plane[w];
+            }
+            else
+            {
+                for (uint64_t w = 0; w < bin_width; ++w)
+                {
+                    greater[w] |= equal[w] & plane[w];
+                    equal[w] &= ~plane[w];
+                }
+            }
+        }
+        for (uint64_t w = 0; w < bin_width; ++w)
+            greater[w] |= equal[w];
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Function select_minimizers()
+// ----------------------------------------------------------------------------
+// select() for minimizers that were computed already, e.g. by another level of
+// a hierarchical filter with the same k-mer and window size.
+
+template <typename TValue, typename THashSpec>
+inline std::vector<uint64_t> const & select_minimizers(IbfSelector<TValue, THashSpec> & me,
+                                                       std::vector<uint64_t> const & kmer_hashes, uint64_t threshold)
+{
+    {
+        StageTimer timer(me.stats, STAGE_HASH);
+        me.offsets.clear();
+        me.multiplicities.clear();
+        me.locate(kmer_hashes);
+    }
+
+    StageTimer timer(me.stats, STAGE_LOOKUP, 1);
+    me.reset(kmer_hashes.size());
+    uint64_t const number_of_hashes = me.ibf.layout.number_of_hashes;
+    for (uint64_t run = 0; run < me.multiplicities.size(); ++run)
+        me.add(me.offsets.data() + run * number_of_hashes, me.multiplicities[run]);
+    me.compare(threshold);
+    return me.mask;
+}
+
+// ----------------------------------------------------------------------------
+// Function select()
+// ----------------------------------------------------------------------------
+// Bins whose count reaches the threshold of thresholds for the length of the
+// text. The result is a mask with one bit per bin and stays valid until the
+// next call with the same selector.
+
+template <typename TValue, typename THashSpec, typename TString>
+inline std::vector<uint64_t> const & select(IbfSelector<TValue, THashSpec> & me, TString const & text,
+                                            ThresholdTable & thresholds)
+{
+    uint64_t threshold;
+    {
+        StageTimer timer(me.stats, STAGE_THRESHOLD, 1);
+        threshold = thresholds.get(me.hasher, length(text));
+    }
+    {
+        StageTimer timer(me.stats, STAGE_HASH);
+        me.hasher.getHash(text, me.kmer_hashes);
+        timer.add_items(me.kmer_hashes.size());
+    }
+    return select_minimizers(me, me.kmer_hashes, threshold);
+}
+
+// Single query with the threshold for the given number of errors, lowered by
+// penalty but never below one.
+
+template <typename TValue, typename THashSpec, typename TString>
+inline std::vector<uint64_t> select(Ibf<TValue, THashSpec> const & me, TString const & text, uint32_t errors,
+                                    uint32_t penalty)
+{
+    IbfSelector<TValue, THashSpec> selector(me);
+    ThresholdTable thresholds(errors, penalty, 0);
+    return select(selector, text, thresholds);
+}
+
+// ----------------------------------------------------------------------------
+// Function select_batch()
+// ----------------------------------------------------------------------------
+// select() for the reads first to last - 1 of reads that are at least as long
+// as the k-mers. Every lookup is a cache miss into the filter, so instead of
+// waiting for the blocks of one read after the other, the minimizers and
+// block offsets of all reads are computed first and all blocks are
+// prefetched, then the reads are counted while the loads are in flight.
+// Calls f(read_index, mask) for the reads in order.
+
+template <typename TValue, typename THashSpec, typename TReads, typename TFunctor>
+inline void select_batch(IbfSelector<TValue, THashSpec> & me, TReads const & reads, uint64_t first, uint64_t last,
+                         ThresholdTable & thresholds, TFunctor && f)
+{
+    uint64_t const number_of_hashes = me.ibf.layout.number_of_hashes;
+    me.offsets.clear();
+    me.multiplicities.clear();
+    me.read_ends.clear();
+    me.read_windows.clear();
+    me.thresholds.clear();
+    for (uint64_t r = first; r < last; ++r)
+    {
+        if (length(reads[r]) < me.ibf.layout.kmer_size)
+            continue;
+        {
+            StageTimer timer(me.stats, STAGE_THRESHOLD, 1);
+            me.thresholds.push_back(thresholds.get(me.hasher, length(reads[r])));
+        }
+
+        // Issuing the prefetches is part of the hash stage, the loads themselves are waited for in the lookup.
+        StageTimer timer(me.stats, STAGE_HASH);
+        uint64_t const read_begin = me.multiplicities.size();
+        me.hasher.getHash(reads[r], me.kmer_hashes);
+        me.locate(me.kmer_hashes);
+        for (uint64_t run = read_begin; run < me.multiplicities.size(); ++run)
+            me.prefetch(me.offsets.data() + run * number_of_hashes);
+        me.read_ends.push_back(me.multiplicities.size());
+        me.read_windows.push_back(me.kmer_hashes.size());
+        timer.add_items(me.kmer_hashes.size());
+    }
+
+    uint64_t read_begin{0};
+    uint64_t read_number{0};
+    for (uint64_t r = first; r < last; ++r)
+    {
+        if (length(reads[r]) < me.ibf.layout.kmer_size)
+            continue;
+        uint64_t const read_end = me.read_ends[read_number];
+        {
+            StageTimer timer(me.stats, STAGE_LOOKUP, 1);
+            me.reset(me.read_windows[read_number]);
+            for (uint64_t run = read_begin; run < read_end; ++run)
+                me.add(me.offsets.data() + run * number_of_hashes, me.multiplicities[run]);
+            me.compare(me.thresholds[read_number]);
+        }
+        f(r, me.mask);
+        read_begin = read_end;
+        ++read_number;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Function for_each_bin()
+// ----------------------------------------------------------------------------
+// Calls f with the number of every bin set in a mask returned by select(), in
+// ascending order.
+
+template <typename TFunctor>
+inline void for_each_bin(std::vector<uint64_t> const & mask, TFunctor && f)
+{
+    for (uint64_t w = 0; w < mask.size(); ++w)
+    {
+        for (uint64_t bits = mask[w]; bits != 0; bits &= bits - 1)
+            f(w * 64 + __builtin_ctzll(bits));
+    }
+}
+
+#endif  // SRA_SEARCH_IBF_H_
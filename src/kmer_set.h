@@ -0,0 +1,182 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#ifndef SRA_SEARCH_KMER_SET_H_
+#define SRA_SEARCH_KMER_SET_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "hash_mix.h"
+
+// ----------------------------------------------------------------------------
+// Class KmerSet
+// ----------------------------------------------------------------------------
+// Set of 64 bit k-mer hashes with open addressing and linear probing. It
+// needs about 8 bytes per slot and stays at most half full, a fraction of the
+// memory of a node based std::unordered_set. Not thread-safe, every thread
+// fills its own set.
+
+class KmerSet
+{
+public:
+    explicit KmerSet(size_t expected = 1024) :
+        number_of_keys(0),
+        has_empty_key(false)
+    {
+        size_t capacity = 16;
+        while (capacity < 2 * expected)
+            capacity *= 2;
+        slots.assign(capacity, empty_key);
+    }
+
+    inline void insert(uint64_t key)
+    {
+        if (key == empty_key)
+        {
+            has_empty_key = true;
+            return;
+        }
+        if (2 * (number_of_keys + 1) > slots.size())
+            grow();
+        insert_slot(key);
+    }
+
+    template <typename TIter>
+    inline void insert(TIter first, TIter last)
+    {
+        for (; first != last; ++first)
+            insert(*first);
+    }
+
+    size_t size() const
+    {
+        return number_of_keys + has_empty_key;
+    }
+
+    void clear()
+    {
+        slots.assign(16, empty_key);
+        number_of_keys = 0;
+        has_empty_key = false;
+    }
+
+    void swap(KmerSet & other)
+    {
+        slots.swap(other.slots);
+        std::swap(number_of_keys, other.number_of_keys);
+        std::swap(has_empty_key, other.has_empty_key);
+    }
+
+    template <typename TFunctor>
+    void for_each(TFunctor && f) const
+    {
+        for (uint64_t key : slots)
+            if (key != empty_key)
+                f(key);
+        if (has_empty_key)
+            f(empty_key);
+    }
+
+private:
+    enum : uint64_t { empty_key = ~0ULL };
+
+    std::vector<uint64_t>   slots;
+    size_t                  number_of_keys;
+    bool                    has_empty_key;
+
+    inline void insert_slot(uint64_t key)
+    {
+        size_t mask = slots.size() - 1;
+        for (size_t slot = mix_hash(key) & mask; ; slot = (slot + 1) & mask)
+        {
+            if (slots[slot] == key)
+                return;
+            if (slots[slot] == empty_key)
+            {
+                slots[slot] = key;
+                ++number_of_keys;
+                return;
+            }
+        }
+    }
+
+    void grow()
+    {
+        std::vector<uint64_t> old_slots(2 * slots.size(), empty_key);
+        old_slots.swap(slots);
+        number_of_keys = 0;
+        for (uint64_t key : old_slots)
+            if (key != empty_key)
+                insert_slot(key);
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Class ConcurrentBitVector
+// ----------------------------------------------------------------------------
+// Bit vector that many threads can set bits in at the same time. Bits are set
+// with an atomic fetch-or, which is skipped if the bit is already set to keep
+// the cache lines of frequent k-mers shared.
+
+class ConcurrentBitVector
+{
+public:
+    explicit ConcurrentBitVector(uint64_t bits) :
+        words((bits + 63) / 64, 0) {}
+
+    inline void set(uint64_t bit)
+    {
+        uint64_t * word = &words[bit / 64];
+        uint64_t mask = 1ULL << (bit % 64);
+        if (!(__atomic_load_n(word, __ATOMIC_RELAXED) & mask))
+            __atomic_fetch_or(word, mask, __ATOMIC_RELAXED);
+    }
+
+    // Only meaningful once all threads setting bits have finished.
+    uint64_t count() const
+    {
+        uint64_t ones{0};
+        for (uint64_t word : words)
+            ones += __builtin_popcountll(word);
+        return ones;
+    }
+
+private:
+    std::vector<uint64_t> words;
+};
+
+#endif  // SRA_SEARCH_KMER_SET_H_
@@ -0,0 +1,363 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#ifndef SRA_SEARCH_MINIMIZER_H_
+#define SRA_SEARCH_MINIMIZER_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SRA_SEARCH_MINIMIZER_AVX2 1
+#include <immintrin.h>
+#endif
+
+#include <seqan/binning_directory.h>
+
+using namespace seqan;
+
+// ----------------------------------------------------------------------------
+// Function minimizer_rank()
+// ----------------------------------------------------------------------------
+// Rank of a base, sequences of plain bytes already hold ranks (see RankView).
+
+template <typename TValue>
+inline uint8_t minimizer_rank(TValue const & value)
+{
+    return ordValue(value);
+}
+
+inline uint8_t minimizer_rank(uint8_t value)
+{
+    return value;
+}
+
+// ----------------------------------------------------------------------------
+// Class MinimizerEngine
+// ----------------------------------------------------------------------------
+// Computes the same minimizers as BDHash<Dna5, Minimizer<k, w>>::getHash, one
+// value per window of w bases: the smallest canonical k-mer hash in the
+// window, where the canonical hash of a k-mer is the smaller of its forward
+// and reverse complement 2 bit encodings, each xor'ed with the seed. N is
+// encoded as A on both strands, as the conversion from Dna5 to Dna does.
+//
+// A call works in three passes over the whole sequence instead of one
+// position at a time: encode the bases, hash all k-mers and take the window
+// minima. If the CPU supports AVX2, four k-mers are hashed at once and the
+// minima are taken by doubling, four positions per instruction. Otherwise the
+// scalar kernels roll a single hash and use the van Herk/Gil-Werman algorithm
+// (prefix and suffix minima of blocks of w - k + 1 k-mers, every window
+// minimum is the minimum of one suffix and one prefix). Both produce
+// identical results.
+
+class MinimizerEngine
+{
+public:
+    MinimizerEngine(uint32_t kmer_size = 19, uint32_t window_size = 25) :
+        use_avx2(cpu_has_avx2())
+    {
+        resize(kmer_size, window_size);
+    }
+
+    void resize(uint32_t new_kmer_size, uint32_t new_window_size)
+    {
+        kmer_size = new_kmer_size;
+        window_size = std::max(new_window_size, new_kmer_size);
+        mask = (kmer_size >= 32) ? ~0ULL : (1ULL << (2 * kmer_size)) - 1;
+        seed = 0x8F3F73B5CF1C9ADEULL >> (64 - 2 * kmer_size);
+    }
+
+    // Disables the AVX2 kernels, e.g. to compare them against the scalar ones.
+    void use_simd(bool enable)
+    {
+        use_avx2 = enable && cpu_has_avx2();
+    }
+
+    bool uses_simd() const
+    {
+        return use_avx2;
+    }
+
+    template <typename TString>
+    void getHash(TString const & text, std::vector<uint64_t> & result)
+    {
+        result.clear();
+        uint64_t text_length = length(text);
+        if (text_length < kmer_size)
+            return;
+
+        uint64_t number_of_kmers = text_length - kmer_size + 1;
+        uint64_t window_kmers = std::min<uint64_t>(window_size - kmer_size + 1, number_of_kmers);
+
+        encode(text, text_length);
+        hashes.resize(number_of_kmers);
+#ifdef SRA_SEARCH_MINIMIZER_AVX2
+        if (use_avx2 && number_of_kmers >= simd_min_kmers)
+            hash_kmers_avx2(number_of_kmers);
+        else
+#endif
+            hash_kmers(0, number_of_kmers);
+
+#ifdef SRA_SEARCH_MINIMIZER_AVX2
+        if (use_avx2)
+        {
+            window_minima_avx2(number_of_kmers, window_kmers, result);
+            return;
+        }
+#endif
+        window_minima(number_of_kmers, window_kmers, result);
+    }
+
+    template <typename TString>
+    std::vector<uint64_t> getHash(TString const & text)
+    {
+        std::vector<uint64_t> result;
+        getHash(text, result);
+        return result;
+    }
+
+private:
+    // Sequences with fewer k-mers are hashed by the scalar kernel, the
+    // interleaving would cost more than it saves.
+    static const uint64_t simd_min_kmers{64};
+
+    uint32_t                kmer_size;
+    uint32_t                window_size;
+    uint64_t                mask;
+    uint64_t                seed;
+    bool                    use_avx2;
+
+    // Forward code in bits 0-1 and reverse complement code in bits 2-3 of every base.
+    std::vector<uint8_t>    codes;
+    std::vector<uint64_t>   hashes;
+    std::vector<uint64_t>   prefix_min;
+    std::vector<uint64_t>   suffix_min;
+
+    static bool cpu_has_avx2()
+    {
+#ifdef SRA_SEARCH_MINIMIZER_AVX2
+        static bool const has_avx2 = __builtin_cpu_supports("avx2");
+        return has_avx2;
+#else
+        return false;
+#endif
+    }
+
+    template <typename TString>
+    void encode(TString const & text, uint64_t text_length)
+    {
+        // A, C, G, T, N
+        static const uint8_t table[5] = {0 | 3 << 2, 1 | 2 << 2, 2 | 1 << 2, 3 | 0 << 2, 0 | 0 << 2};
+        codes.resize(text_length);
+        for (uint64_t i = 0; i < text_length; ++i)
+            codes[i] = table[minimizer_rank(text[i])];
+    }
+
+    // Hashes the k-mers first to last - 1.
+    void hash_kmers(uint64_t first, uint64_t last)
+    {
+        uint64_t const rc_shift = 2 * (kmer_size - 1);
+        uint64_t forward{0};
+        uint64_t reverse{0};
+        uint8_t const * code = codes.data() + first;
+        for (uint64_t i = 0; i + 1 < kmer_size; ++i, ++code)
+        {
+            forward = (forward << 2) | (*code & 3);
+            reverse = (reverse >> 2) | (static_cast<uint64_t>(*code >> 2) << rc_shift);
+        }
+        for (uint64_t i = first; i < last; ++i, ++code)
+        {
+            forward = ((forward << 2) | (*code & 3)) & mask;
+            reverse = (reverse >> 2) | (static_cast<uint64_t>(*code >> 2) << rc_shift);
+            hashes[i] = std::min(forward ^ seed, reverse ^ seed);
+        }
+    }
+
+#ifdef SRA_SEARCH_MINIMIZER_AVX2
+    // Unsigned 64 bit minimum, AVX2 only compares signed integers.
+    __attribute__((target("avx2")))
+    static inline __m256i min_epu64(__m256i a, __m256i b)
+    {
+        __m256i const sign = _mm256_set1_epi64x(0x8000000000000000LL);
+        __m256i greater = _mm256_cmpgt_epi64(_mm256_xor_si256(a, sign), _mm256_xor_si256(b, sign));
+        return _mm256_blendv_epi8(a, b, greater);
+    }
+
+    // Splits the k-mers into four consecutive runs that are rolled in the four
+    // lanes of a register.
+    __attribute__((target("avx2")))
+    void hash_kmers_avx2(uint64_t number_of_kmers)
+    {
+        uint64_t const run = number_of_kmers / 4;
+        uint64_t const steps = run + kmer_size - 1;
+
+        uint8_t const * code0 = codes.data();
+        uint8_t const * code1 = code0 + run;
+        uint8_t const * code2 = code1 + run;
+        uint8_t const * code3 = code2 + run;
+
+        __m256i const two_bits = _mm256_set1_epi64x(3);
+        __m256i const vmask = _mm256_set1_epi64x(mask);
+        __m256i const vseed = _mm256_set1_epi64x(seed);
+        __m128i const rc_shift = _mm_cvtsi32_si128(2 * (kmer_size - 1));
+        __m256i forward = _mm256_setzero_si256();
+        __m256i reverse = _mm256_setzero_si256();
+        uint64_t result[4];
+
+        for (uint64_t i = 0; i < steps; ++i)
+        {
+            __m256i code = _mm256_set_epi64x(code3[i], code2[i], code1[i], code0[i]);
+            forward = _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi64(forward, 2),
+                                                       _mm256_and_si256(code, two_bits)), vmask);
+            reverse = _mm256_or_si256(_mm256_srli_epi64(reverse, 2),
+                                      _mm256_sll_epi64(_mm256_srli_epi64(code, 2), rc_shift));
+            if (i + 1 < kmer_size)
+                continue;
+
+            __m256i canonical = min_epu64(_mm256_xor_si256(forward, vseed), _mm256_xor_si256(reverse, vseed));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(result), canonical);
+            uint64_t kmer = i + 1 - kmer_size;
+            hashes[kmer] = result[0];
+            hashes[run + kmer] = result[1];
+            hashes[2 * run + kmer] = result[2];
+            hashes[3 * run + kmer] = result[3];
+        }
+
+        // The remainder of the division into runs.
+        if (4 * run < number_of_kmers)
+            hash_kmers(4 * run, number_of_kmers);
+    }
+
+    // Window minima by doubling: after the step with span s every hash holds
+    // the minimum of the 2s hashes starting at it, the window minimum is then
+    // the minimum of two overlapping spans. Every step is one pass of
+    // independent minima, unlike the prefix and suffix scans of the scalar
+    // kernel. Overwrites the hashes.
+    __attribute__((target("avx2")))
+    void window_minima_avx2(uint64_t number_of_kmers, uint64_t window_kmers, std::vector<uint64_t> & result)
+    {
+        uint64_t const windows = number_of_kmers - window_kmers + 1;
+        uint64_t * values = hashes.data();
+        uint64_t span = 1;
+        for (; 2 * span <= window_kmers; span *= 2)
+            min_shifted_avx2(values, values, values + span, number_of_kmers - 2 * span + 1);
+
+        result.resize(windows);
+        min_shifted_avx2(result.data(), values, values + window_kmers - span, windows);
+    }
+
+    // out[i] = min(a[i], b[i]) for i < n, out may be a.
+    __attribute__((target("avx2")))
+    static void min_shifted_avx2(uint64_t * out, uint64_t const * a, uint64_t const * b, uint64_t n)
+    {
+        uint64_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(a + i));
+            __m256i y = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(b + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), min_epu64(x, y));
+        }
+        for (; i < n; ++i)
+            out[i] = std::min(a[i], b[i]);
+    }
+#endif
+
+    void window_minima(uint64_t number_of_kmers, uint64_t window_kmers, std::vector<uint64_t> & result)
+    {
+        uint64_t const windows = number_of_kmers - window_kmers + 1;
+        prefix_min.resize(number_of_kmers);
+        suffix_min.resize(number_of_kmers);
+
+        for (uint64_t block = 0; block < number_of_kmers; block += window_kmers)
+        {
+            uint64_t block_end = std::min(block + window_kmers, number_of_kmers);
+            prefix_min[block] = hashes[block];
+            for (uint64_t i = block + 1; i < block_end; ++i)
+                prefix_min[i] = std::min(prefix_min[i - 1], hashes[i]);
+            suffix_min[block_end - 1] = hashes[block_end - 1];
+            for (uint64_t i = block_end - 1; i > block; --i)
+                suffix_min[i - 1] = std::min(suffix_min[i], hashes[i - 1]);
+        }
+
+        result.resize(windows);
+        for (uint64_t i = 0; i < windows; ++i)
+            result[i] = std::min(suffix_min[i], prefix_min[i + window_kmers - 1]);
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Class MinimizerHash
+// ----------------------------------------------------------------------------
+// Drop-in replacement for BDHash<TValue, Minimizer<k, w>> whose getHash() runs
+// on the MinimizerEngine. Everything else, e.g. get_threshold(), is BDHash's.
+
+template <typename TValue, typename THashSpec>
+class MinimizerHash : public BDHash<TValue, THashSpec>
+{
+public:
+    typedef BDHash<TValue, THashSpec> TBase;
+
+    MinimizerHash() :
+        engine(TBase::kmerSize, TBase::windowSize) {}
+
+    void resize(uint16_t new_kmer_size, uint32_t new_window_size)
+    {
+        TBase::resize(new_kmer_size, new_window_size);
+        engine.resize(new_kmer_size, new_window_size);
+    }
+
+    void use_simd(bool enable)
+    {
+        engine.use_simd(enable);
+    }
+
+    template <typename TString>
+    std::vector<uint64_t> getHash(TString const & text)
+    {
+        return engine.getHash(text);
+    }
+
+    template <typename TString>
+    void getHash(TString const & text, std::vector<uint64_t> & result)
+    {
+        engine.getHash(text, result);
+    }
+
+private:
+    MinimizerEngine engine;
+};
+
+#endif  // SRA_SEARCH_MINIMIZER_H_
@@ -0,0 +1,210 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#ifndef SRA_SEARCH_MINIMIZER_FIXTURES_H_
+#define SRA_SEARCH_MINIMIZER_FIXTURES_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+// Function minimizer_fixture_texts()
+// ----------------------------------------------------------------------------
+// The texts of the minimizer fixtures for (k, w), all taken from one fixed
+// text of 160 bases: prefixes of length k - 1, k, k + 1, (k + w) / 2, w - 1,
+// w and w + 1, 150 bases with a run of N longer than a window in the middle,
+// with runs of N at both ends and with every 17th base an N, w + 10 N, and
+// the whole text, which is long enough for the AVX2 kernels.
+
+inline std::vector<std::string> minimizer_fixture_texts(uint32_t k, uint32_t w)
+{
+    std::string const text = "TCGCTGCTGTCGGACTCCTAGTTACGTGGCGTTGCTCCACAGGTAGCCTGCCGTCGTGGTCCGCAACACTCGCACGCTGT"
+                             "TTCAGGGCGATCCTCCGGATAACACCACCTCCACAAACGAAGACAACCCTCTGGTTCTTTCCCGTCCGTAAGACTACTTA";
+    std::vector<std::string> texts;
+    for (uint32_t text_length : {k - 1, k, k + 1, (k + w) / 2, w - 1, w, w + 1})
+        texts.push_back(text.substr(0, text_length));
+
+    std::string middle_n = text.substr(0, 150);
+    middle_n.replace(60, w, w, 'N');
+    texts.push_back(middle_n);
+    std::string edge_n = text.substr(0, 150);
+    edge_n.replace(0, k + 2, k + 2, 'N');
+    edge_n.replace(150 - (k - 1), k - 1, k - 1, 'N');
+    texts.push_back(edge_n);
+    std::string single_n = text.substr(0, 150);
+    for (uint32_t i = 16; i < single_n.size(); i += 17)
+        single_n[i] = 'N';
+    texts.push_back(single_n);
+    texts.push_back(std::string(w + 10, 'N'));
+    texts.push_back(text);
+    return texts;
+}
+
+// ----------------------------------------------------------------------------
+// Function minimizer_digest()
+// ----------------------------------------------------------------------------
+// FNV-1a over the minimizer hashes of a text, one 64 bit word at a time.
+
+inline uint64_t minimizer_digest(std::vector<uint64_t> const & hashes)
+{
+    uint64_t digest{0xcbf29ce484222325ULL};
+    for (uint64_t hash : hashes)
+        digest = (digest ^ hash) * 0x100000001b3ULL;
+    return digest;
+}
+
+// ----------------------------------------------------------------------------
+// Function minimizer_fixtures()
+// ----------------------------------------------------------------------------
+// The number and the digest of the minimizers of minimizer_fixture_texts(k, w)
+// for every supported (k, w). They were computed from the definition of the
+// minimizers of BDHash<Dna5, Minimizer<k, w>>, independently of MinimizerHash:
+// the minimum over each window of w - k + 1 k-mers of min(forward, reverse
+// complement) xor 0x8F3F73B5CF1C9ADE >> (64 - 2k), N counting as A on both
+// strands, and a single window for texts shorter than w.
+
+struct MinimizerFixture
+{
+    uint16_t    kmer_size;
+    uint32_t    window_size;
+    uint32_t    text;
+    uint64_t    count;
+    uint64_t    digest;
+};
+
+inline std::vector<MinimizerFixture> const & minimizer_fixtures()
+{
+    static std::vector<MinimizerFixture> const fixtures{
+        {16, 20,  0,   0, 0xcbf29ce484222325ULL},
+        {16, 20,  1,   1, 0x8826afd28054f915ULL},
+        {16, 20,  2,   1, 0xd25a4e45f56ab042ULL},
+        {16, 20,  3,   1, 0xd25a4e45f56ab042ULL},
+        {16, 20,  4,   1, 0xd25a4e45f56ab042ULL},
+        {16, 20,  5,   1, 0xd25a4e45f56ab042ULL},
+        {16, 20,  6,   2, 0x7cfdd1d89a02e123ULL},
+        {16, 20,  7, 131, 0x8716dbe1eef29b52ULL},
+        {16, 20,  8, 131, 0x48433dd0e8f32743ULL},
+        {16, 20,  9, 131, 0x945624a5510150c7ULL},
+        {16, 20, 10,  11, 0xd8f20f05c8ffabd6ULL},
+        {16, 20, 11, 141, 0xdef72f9515fa9253ULL},
+        {19, 19,  0,   0, 0xcbf29ce484222325ULL},
+        {19, 19,  1,   1, 0xa0b02ed817067833ULL},
+        {19, 19,  2,   2, 0x8e3be618e75c8152ULL},
+        {19, 19,  3,   1, 0xa0b02ed817067833ULL},
+        {19, 19,  4,   0, 0xcbf29ce484222325ULL},
+        {19, 19,  5,   1, 0xa0b02ed817067833ULL},
+        {19, 19,  6,   2, 0x8e3be618e75c8152ULL},
+        {19, 19,  7, 132, 0x0599f4ed95c15063ULL},
+        {19, 19,  8, 132, 0x1c6ccef8de721d8eULL},
+        {19, 19,  9, 132, 0x92cf5b6ab9355fe5ULL},
+        {19, 19, 10,  11, 0xde0b379c569f2f08ULL},
+        {19, 19, 11, 142, 0x551e633763d10519ULL},
+        {19, 23,  0,   0, 0xcbf29ce484222325ULL},
+        {19, 23,  1,   1, 0xa0b02ed817067833ULL},
+        {19, 23,  2,   1, 0x33c825965af82350ULL},
+        {19, 23,  3,   1, 0xb213b60a2d92c62cULL},
+        {19, 23,  4,   1, 0xb213b60a2d92c62cULL},
+        {19, 23,  5,   1, 0xb213b60a2d92c62cULL},
+        {19, 23,  6,   2, 0x2bb4879dafd80e77ULL},
+        {19, 23,  7, 128, 0x49a36c15badfdb41ULL},
+        {19, 23,  8, 128, 0xb7a024c93b1b13dbULL},
+        {19, 23,  9, 128, 0x505bc7619a877dc5ULL},
+        {19, 23, 10,  11, 0xde0b379c569f2f08ULL},
+        {19, 23, 11, 138, 0xd8c1ab66c13bc83fULL},
+        {19, 24,  0,   0, 0xcbf29ce484222325ULL},
+        {19, 24,  1,   1, 0xa0b02ed817067833ULL},
+        {19, 24,  2,   1, 0x33c825965af82350ULL},
+        {19, 24,  3,   1, 0xb213b60a2d92c62cULL},
+        {19, 24,  4,   1, 0xb213b60a2d92c62cULL},
+        {19, 24,  5,   1, 0xb213b60a2d92c62cULL},
+        {19, 24,  6,   2, 0x2bb4879dafd80e77ULL},
+        {19, 24,  7, 127, 0x5367e560702955f8ULL},
+        {19, 24,  8, 127, 0x7ea9f6039bc66d27ULL},
+        {19, 24,  9, 127, 0x339d7e2ff7f4f7d6ULL},
+        {19, 24, 10,  11, 0xde0b379c569f2f08ULL},
+        {19, 24, 11, 137, 0xb096d1d69ab8162cULL},
+        {19, 25,  0,   0, 0xcbf29ce484222325ULL},
+        {19, 25,  1,   1, 0xa0b02ed817067833ULL},
+        {19, 25,  2,   1, 0x33c825965af82350ULL},
+        {19, 25,  3,   1, 0xb213b60a2d92c62cULL},
+        {19, 25,  4,   1, 0xb213b60a2d92c62cULL},
+        {19, 25,  5,   1, 0xb213b60a2d92c62cULL},
+        {19, 25,  6,   2, 0x2bb4879dafd80e77ULL},
+        {19, 25,  7, 126, 0x6b743409af608069ULL},
+        {19, 25,  8, 126, 0xaa2aa80e5b975fabULL},
+        {19, 25,  9, 126, 0x0ee3e8cc3250f7c9ULL},
+        {19, 25, 10,  11, 0xde0b379c569f2f08ULL},
+        {19, 25, 11, 136, 0xdb758ce9e6540f9eULL},
+        {20, 24,  0,   0, 0xcbf29ce484222325ULL},
+        {20, 24,  1,   1, 0xbdf2989234bf37b6ULL},
+        {20, 24,  2,   1, 0xbdf2989234bf37b6ULL},
+        {20, 24,  3,   1, 0xc723d695a25cf113ULL},
+        {20, 24,  4,   1, 0xc723d695a25cf113ULL},
+        {20, 24,  5,   1, 0xc723d695a25cf113ULL},
+        {20, 24,  6,   2, 0xa9169ad34af86a15ULL},
+        {20, 24,  7, 127, 0x7b5097cad0709ba8ULL},
+        {20, 24,  8, 127, 0xf0c9cf2d941b28a5ULL},
+        {20, 24,  9, 127, 0x7050b33a730d27deULL},
+        {20, 24, 10,  11, 0xb744b8eaa67b59dcULL},
+        {20, 24, 11, 137, 0xa9dd2d01ce41f64dULL},
+        {20, 25,  0,   0, 0xcbf29ce484222325ULL},
+        {20, 25,  1,   1, 0xbdf2989234bf37b6ULL},
+        {20, 25,  2,   1, 0xbdf2989234bf37b6ULL},
+        {20, 25,  3,   1, 0xc723d695a25cf113ULL},
+        {20, 25,  4,   1, 0xc723d695a25cf113ULL},
+        {20, 25,  5,   1, 0xc723d695a25cf113ULL},
+        {20, 25,  6,   2, 0xa9169ad34af86a15ULL},
+        {20, 25,  7, 126, 0xe9e7b17e33aa4b64ULL},
+        {20, 25,  8, 126, 0xaef6d033c73f054cULL},
+        {20, 25,  9, 126, 0x400f4e9ffacdfbc1ULL},
+        {20, 25, 10,  11, 0xb744b8eaa67b59dcULL},
+        {20, 25, 11, 136, 0xf7886abfaaf78d09ULL},
+        {23, 27,  0,   0, 0xcbf29ce484222325ULL},
+        {23, 27,  1,   1, 0xfba7248a4ad0c157ULL},
+        {23, 27,  2,   1, 0x244359a289c0c80cULL},
+        {23, 27,  3,   1, 0x5f5b8f6d4b0fe649ULL},
+        {23, 27,  4,   1, 0x5f5b8f6d4b0fe649ULL},
+        {23, 27,  5,   1, 0x5f5b8f6d4b0fe649ULL},
+        {23, 27,  6,   2, 0x0875167889d65ccdULL},
+        {23, 27,  7, 124, 0xff1b608c1dc2fd60ULL},
+        {23, 27,  8, 124, 0x66163e97b1eac368ULL},
+        {23, 27,  9, 124, 0x8d7e5a4045f8eff0ULL},
+        {23, 27, 10,  11, 0xf18099b7efc0c4d4ULL},
+        {23, 27, 11, 134, 0xaabc43911c7de18dULL}
+    };
+    return fixtures;
+}
+
+#endif  // SRA_SEARCH_MINIMIZER_FIXTURES_H_
@@ -0,0 +1,159 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#ifndef SRA_SEARCH_PIPELINE_H_
+#define SRA_SEARCH_PIPELINE_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+
+// ----------------------------------------------------------------------------
+// Class ConcurrentQueue
+// ----------------------------------------------------------------------------
+// Bounded multi-producer/multi-consumer FIFO. push() blocks while the queue is
+// full, pop() blocks while it is empty. After close() no further values are
+// accepted and pop() returns false once the queue has been drained.
+
+template <typename TValue>
+class ConcurrentQueue
+{
+public:
+    explicit ConcurrentQueue(size_t capacity) :
+        capacity(capacity ? capacity : 1),
+        closed(false) {}
+
+    bool push(TValue && value)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        not_full.wait(lock, [this] { return closed || values.size() < capacity; });
+        if (closed)
+            return false;
+        values.push_back(std::move(value));
+        not_empty.notify_one();
+        return true;
+    }
+
+    bool pop(TValue & value)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        not_empty.wait(lock, [this] { return closed || !values.empty(); });
+        if (values.empty())
+            return false;
+        value = std::move(values.front());
+        values.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+
+private:
+    size_t                  capacity;
+    bool                    closed;
+    std::deque<TValue>      values;
+    std::mutex              mtx;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+};
+
+// ----------------------------------------------------------------------------
+// Class OrderedQueue
+// ----------------------------------------------------------------------------
+// Collects values that are produced out of order and hands them out in the
+// order of their sequence numbers (0, 1, 2, ...). A producer is blocked while
+// its number is more than `window` ahead of the next value to be consumed, so
+// a single slow chunk cannot make the queue grow without bound.
+
+template <typename TValue>
+class OrderedQueue
+{
+public:
+    explicit OrderedQueue(size_t window) :
+        window(window ? window : 1),
+        next(0),
+        closed(false) {}
+
+    bool push(uint64_t number, TValue && value)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        not_full.wait(lock, [this, number] { return closed || number < next + window; });
+        if (closed)
+            return false;
+        values.emplace(number, std::move(value));
+        if (number == next)
+            ready.notify_one();
+        return true;
+    }
+
+    bool pop(TValue & value)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        ready.wait(lock, [this] { return closed || (!values.empty() && values.begin()->first == next); });
+        if (values.empty() || values.begin()->first != next)
+            return false;
+        value = std::move(values.begin()->second);
+        values.erase(values.begin());
+        ++next;
+        not_full.notify_all();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        closed = true;
+        not_full.notify_all();
+        ready.notify_all();
+    }
+
+private:
+    size_t                      window;
+    uint64_t                    next;
+    bool                        closed;
+    std::map<uint64_t, TValue>  values;
+    std::mutex                  mtx;
+    std::condition_variable     not_full;
+    std::condition_variable     ready;
+};
+
+#endif  // SRA_SEARCH_PIPELINE_H_
@@ -0,0 +1,198 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#include <seqan/arg_parse.h>
+
+#include "helper.h"
+#include "query_protocol.h"
+#include "result_writer.h"
+
+using namespace seqan;
+
+struct Options
+{
+    CharString  socket_path;
+    CharString  query_file;
+    CharString  output_file;
+
+    uint64_t    batch_size;
+    ResultFormat output_format;
+
+    Options():
+        output_file("search_results.txt"),
+        batch_size(100000),
+        output_format(RESULT_TEXT) {}
+};
+
+void setupArgumentParser(ArgumentParser & parser, Options const & options)
+{
+    setAppName(parser, "SRA_search query client");
+
+    addArgument(parser, ArgParseArgument(ArgParseArgument::STRING, "SOCKET"));
+    setHelpText(parser, 0, "The socket of a running serve");
+
+    addArgument(parser, ArgParseArgument(ArgParseArgument::INPUT_FILE, "QUERY FILE"));
+    setHelpText(parser, 1, "A file containing the reads to query");
+
+    addSection(parser, "Query Options");
+
+    addOption(parser, ArgParseOption("o", "output-file", "Specify an output filename for the results. \
+                                     Default: search_results.txt", ArgParseOption::OUTPUT_FILE));
+
+    addOption(parser, ArgParseOption("f", "output-format", "Write the results as text or in the compact binary \
+                                     format (read index and sample ids).", ArgParseOption::STRING));
+    setValidValues(parser, "output-format", "text binary");
+    setDefaultValue(parser, "output-format", "text");
+
+    addOption(parser, ArgParseOption("n", "batch-size", "Number of reads sent to the server in one request.",
+                                     ArgParseOption::INT64));
+    setMinValue(parser, "batch-size", "1");
+    setDefaultValue(parser, "batch-size", options.batch_size);
+}
+
+ArgumentParser::ParseResult
+parseCommandLine(Options & options, ArgumentParser & parser, int argc, char const ** argv)
+{
+    ArgumentParser::ParseResult res = parse(parser, argc, argv);
+
+    if (res != ArgumentParser::PARSE_OK)
+        return res;
+
+    getArgumentValue(options.socket_path, parser, 0);
+    getArgumentValue(options.query_file, parser, 1);
+
+    if (isSet(parser, "output-file")) getOptionValue(options.output_file, parser, "output-file");
+
+    std::string output_format;
+    if (getOptionValue(output_format, parser, "output-format"))
+        options.output_format = (output_format == "binary") ? RESULT_BINARY : RESULT_TEXT;
+
+    if (isSet(parser, "batch-size")) getOptionValue(options.batch_size, parser, "batch-size");
+
+    return ArgumentParser::PARSE_OK;
+}
+
+// ----------------------------------------------------------------------------
+// Function append_fasta()
+// ----------------------------------------------------------------------------
+// The reads are sent as FASTA, qualities are not needed for the query.
+
+inline void append_fasta(std::string & buffer, FastxRecord const & record)
+{
+    buffer.push_back('>');
+    buffer.append(record.id.data, record.id.size);
+    buffer.push_back('\n');
+    for (size_t i = 0; i < record.seq.size; ++i)
+        buffer.push_back("ACGTN"[record.seq[i]]);
+    buffer.push_back('\n');
+}
+
+inline void query_server(Options const & options)
+{
+    int fd = connect_socket(options.socket_path);
+    try
+    {
+        ServerHello hello;
+        if (!read_all(fd, &hello, sizeof(hello)) ||
+            std::memcmp(hello.magic, server_magic, sizeof(hello.magic)) != 0 || hello.version != protocol_version)
+            throw IOError(std::string(toCString(options.socket_path)) + " is not a compatible query server.");
+
+        ResultWriter out(options.output_file, options.output_format, hello.number_of_samples);
+        SequenceFile query_file(options.query_file);
+        FastxRecord record;
+        std::string payload;
+        std::string answer;
+        uint64_t first_read{0};
+        bool more = query_file.next(record);
+        while (more)
+        {
+            payload.clear();
+            uint64_t number_of_reads{0};
+            for (; more && number_of_reads < options.batch_size; more = query_file.next(record), ++number_of_reads)
+                append_fasta(payload, record);
+
+            QueryRequest request;
+            std::memcpy(request.magic, request_magic, sizeof(request.magic));
+            request.format = options.output_format;
+            request.first_read = first_read;
+            request.size = payload.size();
+            write_all(fd, &request, sizeof(request));
+            write_all(fd, payload.data(), payload.size());
+
+            QueryResponse response;
+            if (!read_all(fd, &response, sizeof(response)) ||
+                std::memcmp(response.magic, response_magic, sizeof(response.magic)) != 0)
+                throw IOError("The server closed the connection.");
+            answer.resize(response.size);
+            if (response.size > 0 && !read_all(fd, &answer[0], response.size))
+                throw IOError("The server closed the connection.");
+            if (response.status != 0)
+                throw RuntimeError("The server failed: " + answer);
+
+            out.write(answer);
+            first_read += number_of_reads;
+        }
+        out.close();
+    }
+    catch (...)
+    {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+}
+
+int main(int argc, char const ** argv)
+{
+    ArgumentParser parser;
+    Options options;
+    setupArgumentParser(parser, options);
+
+    ArgumentParser::ParseResult res = parseCommandLine(options, parser, argc, argv);
+
+    if (res != ArgumentParser::PARSE_OK)
+        return res == ArgumentParser::PARSE_ERROR;
+
+    try
+    {
+        query_server(options);
+    }
+    catch (Exception const & e)
+    {
+        std::cerr << getAppName(parser) << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,201 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#ifndef SRA_SEARCH_QUERY_PROTOCOL_H_
+#define SRA_SEARCH_QUERY_PROTOCOL_H_
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <seqan/basic.h>
+#include <seqan/sequence.h>
+
+using namespace seqan;
+
+// ----------------------------------------------------------------------------
+// Query protocol
+// ----------------------------------------------------------------------------
+// serve keeps a filter loaded and answers query batches over a Unix domain
+// socket. After connecting, a client receives a ServerHello and then sends
+// any number of requests, each answered before the next is read:
+//
+//   QueryRequest, followed by size bytes of FASTA or FASTQ records
+//   QueryResponse, followed by size bytes of results in the requested format
+//                  (binary results without the file header), or of an error
+//                  message if status is not 0
+//
+// A request larger than the limit of the server is answered with an error
+// without reading its records, and the server closes the connection.
+//
+// All integers are in host byte order, client and server run on the same
+// machine.
+
+struct ServerHello
+{
+    char        magic[4];
+    uint32_t    version;
+    uint64_t    number_of_samples;
+};
+
+struct QueryRequest
+{
+    char        magic[4];
+    uint32_t    format;
+    // Index of the first read of the batch, used in binary results.
+    uint64_t    first_read;
+    uint64_t    size;
+};
+
+struct QueryResponse
+{
+    char        magic[4];
+    uint32_t    status;
+    uint64_t    size;
+};
+
+static const char server_magic[4] = {'S', 'R', 'A', 'S'};
+static const char request_magic[4] = {'S', 'R', 'A', 'Q'};
+static const char response_magic[4] = {'S', 'R', 'A', 'R'};
+static const uint32_t protocol_version{1};
+
+// ----------------------------------------------------------------------------
+// Function read_all()
+// ----------------------------------------------------------------------------
+// Reads exactly size bytes. Returns false if the peer closed the connection
+// before the first byte, throws if it did so in the middle.
+
+inline bool read_all(int fd, void * data, size_t size)
+{
+    char * buffer = static_cast<char *>(data);
+    size_t done{0};
+    while (done < size)
+    {
+        ssize_t bytes = ::read(fd, buffer + done, size - done);
+        if (bytes == -1 && errno == EINTR)
+            continue;
+        if (bytes == -1)
+            throw IOError("Unable to read from socket: " + std::string(std::strerror(errno)));
+        if (bytes == 0)
+        {
+            if (done == 0)
+                return false;
+            throw IOError("Connection closed in the middle of a message.");
+        }
+        done += bytes;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// Function write_all()
+// ----------------------------------------------------------------------------
+
+inline void write_all(int fd, void const * data, size_t size)
+{
+    char const * buffer = static_cast<char const *>(data);
+    while (size > 0)
+    {
+        // MSG_NOSIGNAL: a vanished peer is an error, not a SIGPIPE.
+        ssize_t bytes = ::send(fd, buffer, size, MSG_NOSIGNAL);
+        if (bytes == -1 && errno == EINTR)
+            continue;
+        if (bytes == -1)
+            throw IOError("Unable to write to socket: " + std::string(std::strerror(errno)));
+        buffer += bytes;
+        size -= bytes;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Function socket_address()
+// ----------------------------------------------------------------------------
+
+inline sockaddr_un socket_address(CharString const & socket_path)
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (length(socket_path) >= sizeof(address.sun_path))
+        throw IOError("Socket path is too long: " + std::string(toCString(socket_path)));
+    std::strcpy(address.sun_path, toCString(socket_path));
+    return address;
+}
+
+// ----------------------------------------------------------------------------
+// Function listen_socket()
+// ----------------------------------------------------------------------------
+// Creates the socket file, replacing a stale one of a previous server.
+
+inline int listen_socket(CharString const & socket_path)
+{
+    sockaddr_un address = socket_address(socket_path);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        throw IOError("Unable to create socket: " + std::string(std::strerror(errno)));
+    ::unlink(address.sun_path);
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1 || ::listen(fd, 64) == -1)
+    {
+        int error = errno;
+        ::close(fd);
+        throw IOError("Unable to listen on " + std::string(toCString(socket_path)) + ": " + std::strerror(error));
+    }
+    return fd;
+}
+
+// ----------------------------------------------------------------------------
+// Function connect_socket()
+// ----------------------------------------------------------------------------
+
+inline int connect_socket(CharString const & socket_path)
+{
+    sockaddr_un address = socket_address(socket_path);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        throw IOError("Unable to create socket: " + std::string(std::strerror(errno)));
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1)
+    {
+        int error = errno;
+        ::close(fd);
+        throw IOError("Unable to connect to " + std::string(toCString(socket_path)) + ": " + std::strerror(error));
+    }
+    return fd;
+}
+
+#endif  // SRA_SEARCH_QUERY_PROTOCOL_H_
@@ -0,0 +1,248 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#ifndef SRA_SEARCH_RESULT_WRITER_H_
+#define SRA_SEARCH_RESULT_WRITER_H_
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <seqan/sequence.h>
+
+#include "sample_map.h"
+
+using namespace seqan;
+
+// ----------------------------------------------------------------------------
+// Result formats
+// ----------------------------------------------------------------------------
+// text:   per read a line with the read id and a line with the comma separated
+//         sample names, "NA" if there is none.
+// binary: the header "SRARES01" followed by the number of samples (64 bit),
+//         then per read its index in the query file (64 bit), the number of
+//         samples (32 bit) and the sample ids in ascending order (32 bit each).
+//         All integers are little endian.
+
+enum ResultFormat
+{
+    RESULT_TEXT,
+    RESULT_BINARY
+};
+
+// ----------------------------------------------------------------------------
+// Function append_result()
+// ----------------------------------------------------------------------------
+// Appends the result of one read to a buffer and empties hits.
+
+template <typename TId>
+inline void append_result(std::string & buffer, ResultFormat format, uint64_t read_index, TId const & id,
+                          SampleSet & hits, SampleMap const & samples)
+{
+    if (format == RESULT_BINARY)
+    {
+        size_t record_begin = buffer.size();
+        uint32_t found{0};
+        buffer.append(reinterpret_cast<char const *>(&read_index), sizeof(read_index));
+        buffer.append(reinterpret_cast<char const *>(&found), sizeof(found));
+        found = hits.drain([&] (uint32_t sample) {
+            buffer.append(reinterpret_cast<char const *>(&sample), sizeof(sample));
+        });
+        std::memcpy(&buffer[record_begin + sizeof(read_index)], &found, sizeof(found));
+        return;
+    }
+
+    buffer.append(begin(id, Standard()), end(id, Standard()));
+    buffer.push_back('\n');
+    const auto separator = ",";
+    const auto* sep = "";
+    size_t found = hits.drain([&] (uint32_t sample) {
+        buffer.append(sep);
+        buffer.append(samples.names[sample]);
+        sep = separator;
+    });
+    if (!found)
+        buffer.append("NA");
+    buffer.push_back('\n');
+}
+
+// ----------------------------------------------------------------------------
+// Class ResultWriter
+// ----------------------------------------------------------------------------
+// Collects the output in a large user-space buffer that is only written to
+// the file when it is full or the writer is closed, so no record ever causes
+// a flush on its own.
+
+class ResultWriter
+{
+public:
+    ResultWriter(CharString const & file_name, ResultFormat format, uint64_t number_of_samples,
+                 size_t buffer_size = 16ULL << 20) :
+        file_name(toCString(file_name)),
+        capacity(buffer_size)
+    {
+        fd = ::open(toCString(file_name), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1)
+            throw IOError("Unable to open output file: " + this->file_name);
+        buffer.reserve(capacity);
+        if (format == RESULT_BINARY)
+        {
+            buffer.append("SRARES01");
+            buffer.append(reinterpret_cast<char const *>(&number_of_samples), sizeof(number_of_samples));
+        }
+    }
+
+    ResultWriter(ResultWriter const &) = delete;
+    ResultWriter & operator=(ResultWriter const &) = delete;
+
+    ~ResultWriter()
+    {
+        if (fd != -1)
+        {
+            try
+            {
+                close();
+            }
+            catch (...) {}
+        }
+    }
+
+    void write(char const * data, size_t size)
+    {
+        if (buffer.size() + size > capacity)
+        {
+            flush();
+            if (size >= capacity)
+            {
+                write_all(data, size);
+                return;
+            }
+        }
+        buffer.append(data, size);
+    }
+
+    void write(std::string const & data)
+    {
+        write(data.data(), data.size());
+    }
+
+    void close()
+    {
+        flush();
+        if (::close(fd) == -1)
+        {
+            fd = -1;
+            throw IOError("Unable to write output file: " + file_name);
+        }
+        fd = -1;
+    }
+
+private:
+    std::string file_name;
+    std::string buffer;
+    size_t      capacity;
+    int         fd;
+
+    void flush()
+    {
+        write_all(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+
+    void write_all(char const * data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t written = ::write(fd, data, size);
+            if (written == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                throw IOError("Unable to write output file: " + file_name);
+            }
+            data += written;
+            size -= written;
+        }
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Class ResultReader
+// ----------------------------------------------------------------------------
+// Reads a result file in the binary format record by record.
+
+class ResultReader
+{
+public:
+    uint64_t number_of_samples;
+
+    explicit ResultReader(CharString const & file_name) :
+        file_name(toCString(file_name)),
+        buffer(1ULL << 20)
+    {
+        in.rdbuf()->pubsetbuf(&buffer[0], buffer.size());
+        in.open(toCString(file_name), std::ios::binary);
+        char magic[8];
+        in.read(magic, sizeof(magic));
+        in.read(reinterpret_cast<char *>(&number_of_samples), sizeof(number_of_samples));
+        if (!in || std::memcmp(magic, "SRARES01", sizeof(magic)) != 0)
+            throw IOError("File: " + this->file_name + " is not a binary result file!");
+    }
+
+    bool next(uint64_t & read_index, std::vector<uint32_t> & samples)
+    {
+        uint32_t found{0};
+        if (!in.read(reinterpret_cast<char *>(&read_index), sizeof(read_index)))
+            return false;
+        in.read(reinterpret_cast<char *>(&found), sizeof(found));
+        samples.resize(found);
+        in.read(reinterpret_cast<char *>(samples.data()), found * sizeof(uint32_t));
+        if (!in)
+            throw IOError("Binary result file " + file_name + " is truncated.");
+        return true;
+    }
+
+private:
+    std::string         file_name;
+    std::vector<char>   buffer;
+    std::ifstream       in;
+};
+
+#endif  // SRA_SEARCH_RESULT_WRITER_H_
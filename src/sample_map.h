@@ -0,0 +1,237 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#ifndef SRA_SEARCH_SAMPLE_MAP_H_
+#define SRA_SEARCH_SAMPLE_MAP_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <seqan/sequence.h>
+
+using namespace seqan;
+
+// ----------------------------------------------------------------------------
+// Class SampleMap
+// ----------------------------------------------------------------------------
+// Maps every bin of a filter to the sample (e.g. SRA run) it belongs to.
+// Sample ids are assigned in lexicographic order of the sample names, so
+// reporting ids in ascending order reports the names sorted.
+//
+// The map is stored next to the filter (<filter>.samples) as
+//   "SRASMAP1", number of bins, number of samples   (64 bit each)
+//   sample id of every bin                          (32 bit each)
+//   length (32 bit) and characters of every sample name
+
+struct SampleMap
+{
+    std::vector<uint32_t>       bin_to_sample;
+    std::vector<std::string>    names;
+};
+
+// ----------------------------------------------------------------------------
+// Function identity_sample_map()
+// ----------------------------------------------------------------------------
+// Every bin is its own sample, named by the bin number.
+
+inline void identity_sample_map(SampleMap & me, uint64_t number_of_bins)
+{
+    me.bin_to_sample.resize(number_of_bins);
+    me.names.resize(number_of_bins);
+    for (uint64_t bin_number = 0; bin_number < number_of_bins; ++bin_number)
+    {
+        me.bin_to_sample[bin_number] = bin_number;
+        me.names[bin_number] = std::to_string(bin_number);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Function read_sample_table()
+// ----------------------------------------------------------------------------
+// Reads a tab separated table with the columns bin number and sample name.
+// Empty lines and lines starting with '#' are skipped.
+
+inline void read_sample_table(SampleMap & me, CharString const & file_name, uint64_t number_of_bins)
+{
+    std::ifstream in(toCString(file_name));
+    if (!in)
+        throw IOError("Unable to open sample table: " + std::string(toCString(file_name)));
+
+    std::vector<std::string> bin_names(number_of_bins);
+    std::string line;
+    for (uint64_t line_number = 1; std::getline(in, line); ++line_number)
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        uint64_t bin_number;
+        std::string name;
+        if (!(fields >> bin_number >> name) || bin_number >= number_of_bins)
+            throw ParseError("Invalid line " + std::to_string(line_number) + " in sample table: " + line);
+        bin_names[bin_number] = name;
+    }
+
+    for (uint64_t bin_number = 0; bin_number < number_of_bins; ++bin_number)
+        if (bin_names[bin_number].empty())
+            throw ParseError("Sample table has no entry for bin " + std::to_string(bin_number) + ".");
+
+    std::map<std::string, uint32_t> sample_ids;
+    for (auto const & name : bin_names)
+        sample_ids.emplace(name, 0);
+    me.names.clear();
+    for (auto & sample : sample_ids)
+    {
+        sample.second = me.names.size();
+        me.names.push_back(sample.first);
+    }
+    me.bin_to_sample.resize(number_of_bins);
+    for (uint64_t bin_number = 0; bin_number < number_of_bins; ++bin_number)
+        me.bin_to_sample[bin_number] = sample_ids[bin_names[bin_number]];
+}
+
+// ----------------------------------------------------------------------------
+// Function store()
+// ----------------------------------------------------------------------------
+
+inline void store(SampleMap const & me, CharString const & file_name)
+{
+    std::ofstream out(toCString(file_name), std::ios::binary);
+    uint64_t header[3] = {0, me.bin_to_sample.size(), me.names.size()};
+    std::memcpy(header, "SRASMAP1", sizeof(uint64_t));
+    out.write(reinterpret_cast<char const *>(header), sizeof(header));
+    out.write(reinterpret_cast<char const *>(me.bin_to_sample.data()), me.bin_to_sample.size() * sizeof(uint32_t));
+    for (auto const & name : me.names)
+    {
+        uint32_t name_length = name.size();
+        out.write(reinterpret_cast<char const *>(&name_length), sizeof(name_length));
+        out.write(name.data(), name_length);
+    }
+    if (!out)
+        throw IOError("Unable to write sample map: " + std::string(toCString(file_name)));
+}
+
+// ----------------------------------------------------------------------------
+// Function retrieve()
+// ----------------------------------------------------------------------------
+// Returns false if the file does not exist.
+
+inline bool retrieve(SampleMap & me, CharString const & file_name)
+{
+    std::ifstream in(toCString(file_name), std::ios::binary);
+    if (!in)
+        return false;
+
+    uint64_t header[3];
+    in.read(reinterpret_cast<char *>(header), sizeof(header));
+    if (!in || std::memcmp(header, "SRASMAP1", sizeof(uint64_t)) != 0)
+        throw IOError("File: " + std::string(toCString(file_name)) + " is not a valid sample map!");
+
+    me.bin_to_sample.resize(header[1]);
+    me.names.resize(header[2]);
+    in.read(reinterpret_cast<char *>(me.bin_to_sample.data()), me.bin_to_sample.size() * sizeof(uint32_t));
+    for (auto & name : me.names)
+    {
+        uint32_t name_length{0};
+        in.read(reinterpret_cast<char *>(&name_length), sizeof(name_length));
+        name.resize(name_length);
+        in.read(&name[0], name_length);
+    }
+    if (!in || std::any_of(me.bin_to_sample.begin(), me.bin_to_sample.end(),
+                           [&me] (uint32_t sample) { return sample >= me.names.size(); }))
+        throw IOError("File: " + std::string(toCString(file_name)) + " is not a valid sample map!");
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// Function load_samples()
+// ----------------------------------------------------------------------------
+// Reads the sample map stored next to a filter, or maps every bin to itself
+// if there is none.
+
+inline void load_samples(SampleMap & samples, CharString const & sample_map_file, uint64_t number_of_bins)
+{
+    if (!retrieve(samples, sample_map_file))
+        identity_sample_map(samples, number_of_bins);
+    else if (samples.bin_to_sample.size() != number_of_bins)
+        throw RuntimeError("The sample map " + std::string(toCString(sample_map_file)) +
+                           " does not match the number of bins of the filter.");
+}
+
+// ----------------------------------------------------------------------------
+// Class SampleSet
+// ----------------------------------------------------------------------------
+// Reusable bitset over the sample ids that collects the samples hit by a read.
+
+class SampleSet
+{
+public:
+    explicit SampleSet(size_t number_of_samples) :
+        words((number_of_samples + 63) / 64, 0) {}
+
+    inline void insert(uint32_t sample)
+    {
+        words[sample / 64] |= 1ULL << (sample % 64);
+    }
+
+    // Calls f(sample) for every sample in ascending order and empties the set.
+    // Returns the number of samples visited.
+    template <typename TFunctor>
+    inline size_t drain(TFunctor && f)
+    {
+        size_t visited{0};
+        for (size_t w = 0; w < words.size(); ++w)
+        {
+            uint64_t word = words[w];
+            words[w] = 0;
+            while (word)
+            {
+                f(w * 64 + __builtin_ctzll(word));
+                word &= word - 1;
+                ++visited;
+            }
+        }
+        return visited;
+    }
+
+private:
+    std::vector<uint64_t> words;
+};
+
+#endif  // SRA_SEARCH_SAMPLE_MAP_H_
@@ -32,12 +32,21 @@
 // Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
 // ==========================================================================
 
-#include <set>
+#include <cstdio>
+#include <future>
+#include <memory>
 
 #include <seqan/arg_parse.h>
 #include <seqan/binning_directory.h>
 
 #include "helper.h"
+#include "dispatch.h"
+#include "hierarchy.h"
+#include "ibf.h"
+#include "pipeline.h"
+#include "result_writer.h"
+#include "sample_map.h"
+#include "shards.h"
 
 using namespace seqan;
 
@@ -47,6 +56,7 @@ struct Options
     CharString  query_file;
     CharString  filter_file;
     CharString  output_file;
+    CharString  stats_file;
 
     uint32_t    errors;
     uint32_t    penalty;
@@ -56,16 +66,33 @@ struct Options
     // uint64_t    size_of_ibf;
     // uint32_t    number_of_hashes;
     unsigned    threads;
+    uint32_t    chunk_size;
+    uint32_t    batch_size;
+    bool        mmap;
+    bool        stats;
+    ResultFormat output_format;
 
     Options():
         errors(0),
         penalty(0),
         // kmer_size(19),
-        window_size(24),
+        window_size(0),
         // number_of_bins(64),
         // size_of_ibf(16_g),
         // number_of_hashes(3),
-        threads(1) {}
+        threads(1),
+        chunk_size(10000),
+        batch_size(0),
+        mmap(false),
+        stats(false),
+        output_format(RESULT_TEXT) {}
+};
+
+struct QueryChunk
+{
+    uint64_t                number;
+    uint64_t                first_read;
+    RecordBatch             reads;
 };
 
 void setupArgumentParser(ArgumentParser & parser, Options const & options)
@@ -84,6 +111,11 @@ void setupArgumentParser(ArgumentParser & parser, Options const & options)
     addOption(parser, ArgParseOption("o", "output-file", "Specify an output filename for the results. \
                                      Default: search_results.txt", ArgParseOption::OUTPUT_FILE));
 
+    addOption(parser, ArgParseOption("f", "output-format", "Write the results as text or in the compact binary \
+                                     format (read index and sample ids).", ArgParseOption::STRING));
+    setValidValues(parser, "output-format", "text binary");
+    setDefaultValue(parser, "output-format", "text");
+
     // addOption(parser, ArgParseOption("b", "number-of-bins", "The number of bins",
     //                                  ArgParseOption::INTEGER));
 
@@ -95,6 +127,25 @@ void setupArgumentParser(ArgumentParser & parser, Options const & options)
     setMaxValue(parser, "threads", "2048");
     setDefaultValue(parser, "threads", options.threads);
 
+    addOption(parser, ArgParseOption("c", "chunk-size", "Number of reads that are read and queried as one unit of work.",
+                                     ArgParseOption::INTEGER));
+    setMinValue(parser, "chunk-size", "1");
+    setDefaultValue(parser, "chunk-size", options.chunk_size);
+
+    addOption(parser, ArgParseOption("q", "query-batch", "Number of reads whose filter blocks are prefetched together \
+                                     before they are counted. Default: 0, query the reads one by one.",
+                                     ArgParseOption::INTEGER));
+    setMinValue(parser, "query-batch", "0");
+    setMaxValue(parser, "query-batch", "4096");
+
+    addOption(parser, ArgParseOption("m", "mmap", "Map the filter file into memory and query it in place instead of \
+                                     loading it. The mapping is shared by all processes using the same filter."));
+
+    addOption(parser, ArgParseOption("", "stats", "Print the time spent per stage (read, hash, threshold, lookup, \
+                                     write) and the hardware counters of all threads."));
+    addOption(parser, ArgParseOption("", "stats-file", "Write the stats as JSON to this file, implies --stats.",
+                                     ArgParseOption::OUTPUT_FILE));
+
     addOption(parser, ArgParseOption("e", "errors", "Maximum number of errors to allow.", ArgParseOption::INTEGER));
     setMinValue(parser, "errors", "0");
     setMaxValue(parser, "errors", "10");
@@ -110,7 +161,8 @@ void setupArgumentParser(ArgumentParser & parser, Options const & options)
     // setMinValue(parser, "kmer-size", "14");
     // setMaxValue(parser, "kmer-size", "32");
 
-    addOption(parser, ArgParseOption("w", "window-size", "The size of the window for the IBF",
+    addOption(parser, ArgParseOption("w", "window-size", "The size of the window for the IBF. \
+                                     Default: the window size stored in the filter, 24 if it has none.",
                                      ArgParseOption::INTEGER));
     setMinValue(parser, "window-size", "14");
 
@@ -149,12 +201,21 @@ parseCommandLine(Options & options, ArgumentParser & parser, int argc, char cons
         options.output_file = CharString("search_results.txt");
     }
 
+    std::string output_format;
+    if (getOptionValue(output_format, parser, "output-format"))
+        options.output_format = (output_format == "binary") ? RESULT_BINARY : RESULT_TEXT;
+
     if (isSet(parser, "errors")) getOptionValue(options.errors, parser, "errors");
     if (isSet(parser, "penalty")) getOptionValue(options.penalty, parser, "penalty");
     // if (isSet(parser, "number-of-bins")) getOptionValue(options.number_of_bins, parser, "number-of-bins");
     // if (isSet(parser, "kmer-size")) getOptionValue(options.kmer_size, parser, "kmer-size");
     if (isSet(parser, "window-size")) getOptionValue(options.window_size, parser, "window-size");
     if (isSet(parser, "threads")) getOptionValue(options.threads, parser, "threads");
+    if (isSet(parser, "chunk-size")) getOptionValue(options.chunk_size, parser, "chunk-size");
+    if (isSet(parser, "query-batch")) getOptionValue(options.batch_size, parser, "query-batch");
+    options.mmap = isSet(parser, "mmap");
+    getOptionValue(options.stats_file, parser, "stats-file");
+    options.stats = isSet(parser, "stats") || !empty(options.stats_file);
     // if (isSet(parser, "num-hash")) getOptionValue(options.number_of_hashes, parser, "num-hash");
 
     // std::string ibf_size;
@@ -178,160 +239,136 @@ parseCommandLine(Options & options, ArgumentParser & parser, int argc, char cons
     return ArgumentParser::PARSE_OK;
 }
 
+// Queries an Ibf or a Hierarchy.
 template <typename TFilter>
-inline void search_filter(Options & options, TFilter & filter)
+inline void search_filter(Options & options, TFilter const & filter, SampleMap const & samples,
+                          uint64_t first_bin, Stats & stats)
 {
-    std::array<uint32_t, 255> bin2file{
-        0,0,0,0,
-        1,1,1,1,1,1,
-        2,2,2,2,2,2,
-        3,3,3,3,3,
-        4,4,4,4,
-        5,5,5,5,5,5,
-        6,6,6,6,6,
-        7,7,7,7,7,
-        8,8,8,8,8,
-        9,9,9,9,9,9,
-        10,10,10,10,10,
-        11,11,11,11,11,
-        12,12,12,12,12,12,12,
-        13,13,13,13,13,13,13,13,13,13,
-        14,14,14,14,14,14,14,14,14,14,
-        15,15,15,15,15,15,15,15,15,15,15,
-        16,16,16,16,16,16,16,16,16,16,16,16,
-        17,17,17,17,17,17,17,17,17,17,17,
-        18,18,18,18,
-        19,19,19,19,
-        20,20,20,20,
-        21,21,21,
-        22,22,22,
-        23,23,
-        24,24,24,24,
-        25,25,25,25,25,25,
-        26,26,26,26,
-        27,27,27,
-        28,28,28,28,
-        29,29,29,29,
-        30,30,30,30,30,30,30,
-        31,31,31,31,31,31,
-        32,32,32,32,32,32,
-        33,33,33,33,33,
-        34,34,34,34,
-        35,35,35,
-        36,36,36,
-        37,37,37,
-        38,38,38,38,
-        39,39,39,
-        40,40,40,
-        41,41,41,41,
-        42,42,42,42,
-        43,43,
-        44,44,44,44,
-        45,45,45,45,45,45,45,45,
-        46,46,46,46,
-        47,
-        48,48,48,48,
-        49,49,49,49,49,49,49,49,49};
-    std::array<std::string, 50> file2srr{
-        "SRR1523653",
-        "SRR1523654",
-        "SRR1523655",
-        "SRR1523656",
-        "SRR1523657",
-        "SRR1523658",
-        "SRR1523659",
-        "SRR1523661",
-        "SRR1523662",
-        "SRR1523663",
-        "SRR1523664",
-        "SRR1523665",
-        "SRR1523666",
-        "SRR2038259",
-        "SRR2038310",
-        "SRR2038322",
-        "SRR2038440",
-        "SRR2038441",
-        "SRR5444611",
-        "SRR5444613",
-        "SRR5444615",
-        "SRR5444617",
-        "SRR5444619",
-        "SRR5444621",
-        "SRR5444623",
-        "SRR5444625",
-        "SRR5444643",
-        "SRR5444645",
-        "SRR5444647",
-        "SRR5444649",
-        "SRR5444651",
-        "SRR5444653",
-        "SRR5444655",
-        "SRR5444657",
-        "SRR5444661",
-        "SRR5444665",
-        "SRR5444669",
-        "SRR5756304",
-        "SRR5756312",
-        "SRR5756317",
-        "SRR5756320",
-        "SRR5756324",
-        "SRR5762372",
-        "SRR5762373",
-        "SRR5762374",
-        "SRR5762375",
-        "SRR5762376",
-        "SRR5762377",
-        "SRR5762378",
-        "SRR5762379"
+    SequenceFile query_file(options.query_file, 0, std::numeric_limits<uint64_t>::max(), options.threads);
+    ResultWriter out(options.output_file, options.output_format, samples.names.size());
+
+    // The reads are processed in a pipeline: this thread reads chunks of records, options.threads workers query
+    // the shared filter and a writer thread outputs the results of the chunks in the order they were read.
+    ConcurrentQueue<QueryChunk> chunks(2 * options.threads);
+    OrderedQueue<std::string> results(4 * options.threads);
+
+    auto abort_pipeline = [&chunks, &results] {
+        chunks.close();
+        results.close();
     };
-    Dna5String seq;
-    CharString id;
-    SeqFileIn seq_file_in;
-    if (!open(seq_file_in, toCString(options.query_file)))
-    {
-        CharString msg = "Unable to open contigs file: ";
-        append(msg, CharString(options.query_file));
-        std::cerr << msg << std::endl;
-        throw toCString(msg);
-    }
-    std::ofstream out(toCString(options.output_file));
-    while(!atEnd(seq_file_in))
-    {
-        readRecord(id, seq, seq_file_in);
-        if(length(seq) < getKmerSize(filter))
-            continue;
-        // std::vector<uint64_t> result = count<Minimizer<19, 24>>(filter, seq);
-        // std::cerr << "Read " << id << " counts in bins:\n";
-        // for (size_t i = 0; i < result.size(); ++i)
-        // {
-        //     if (result[i])
-        //         std::cerr << i << ' ' << result[i] << " || ";
-        // }
-        // std::cerr << std::endl;
-        std::vector<bool> result = select(filter, seq, options.errors, options.penalty);
-        std::set<std::string> bins;
-        for (size_t i = 0; i < result.size(); ++i)
+
+    std::future<void> writer = std::async(std::launch::async, [&out, &results, &abort_pipeline, &stats] {
+        try
         {
-            if (result[i])
+            StatsRecorder recorder(stats);
+            std::string text;
+            while (results.pop(text))
             {
-                bins.insert(file2srr[bin2file[i]]);
+                StageTimer timer(&recorder, STAGE_WRITE, text.size());
+                out.write(text);
             }
+            StageTimer timer(&recorder, STAGE_WRITE);
+            out.close();
+        }
+        catch (...)
+        {
+            abort_pipeline();
+            throw;
         }
-        out << id << '\n';
-        if (!bins.empty())
+    });
+
+    ThresholdTable thresholds(options.errors, options.penalty);
+    std::vector<std::future<void>> tasks;
+
+    for (uint32_t task_number = 0; task_number < options.threads; ++task_number)
+    {
+        tasks.emplace_back(std::async(std::launch::async, [&] {
+            try
+            {
+                StatsRecorder recorder(stats);
+                typename TFilter::TSelector selector(filter, &recorder);
+                QueryChunk chunk;
+                while (chunks.pop(chunk))
+                {
+                    std::string text;
+                    SampleSet hits(samples.names.size());
+                    auto report = [&] (uint64_t r, std::vector<uint64_t> const & mask) {
+                        StageTimer timer(&recorder, STAGE_WRITE);
+                        size_t text_size = text.size();
+                        for_each_bin(mask, [&] (uint64_t bin_number) {
+                            hits.insert(samples.bin_to_sample[first_bin + bin_number]);
+                        });
+                        append_result(text, options.output_format, chunk.first_read + r, chunk.reads.id(r),
+                                      hits, samples);
+                        timer.add_items(text.size() - text_size);
+                    };
+                    uint64_t number_of_reads = length(chunk.reads);
+                    if (options.batch_size > 0)
+                    {
+                        for (uint64_t r = 0; r < number_of_reads; r += options.batch_size)
+                        {
+                            select_batch(selector, chunk.reads, r, std::min<uint64_t>(r + options.batch_size,
+                                         number_of_reads), thresholds, report);
+                        }
+                    }
+                    else
+                    {
+                        for (uint64_t r = 0; r < number_of_reads; ++r)
+                        {
+                            if(length(chunk.reads[r]) < getKmerSize(filter))
+                                continue;
+                            report(r, select(selector, chunk.reads[r], thresholds));
+                        }
+                    }
+                    results.push(chunk.number, std::move(text));
+                }
+            }
+            catch (...)
+            {
+                abort_pipeline();
+                throw;
+            }
+        }));
+    }
+
+    try
+    {
+        StatsRecorder recorder(stats);
+        FastxRecord record;
+        bool more = query_file.next(record);
+        for (uint64_t number = 0; more; ++number)
         {
-            const auto separator = ",";
-            const auto* sep = "";
-            for(auto const & item : bins) {
-                out << sep << item;
-                sep = separator;
+            QueryChunk chunk;
+            chunk.number = number;
+            chunk.first_read = number * options.chunk_size;
+            {
+                StageTimer timer(&recorder, STAGE_READ);
+                for (; more && length(chunk.reads) < options.chunk_size; more = query_file.next(record))
+                {
+                    chunk.reads.push_back(record);
+                    timer.add_items(record.seq.size);
+                }
             }
+            if (!chunks.push(std::move(chunk)))
+                break;
         }
-        else
-            out << "NA";
+    }
+    catch (...)
+    {
+        abort_pipeline();
+        for (auto &&task : tasks)
+            task.wait();
+        writer.wait();
+        throw;
+    }
+    chunks.close();
 
-        out << std::endl;
+    for (auto &&task : tasks)
+    {
+        task.get();
     }
+    results.close();
+    writer.get();
     // std::string com_ext = common_ext(options.contigs_dir, options.number_of_bins);
     //
     // uint32_t batch_size = options.number_of_bins/options.threads;
@@ -377,6 +414,90 @@ inline void search_filter(Options & options, TFilter & filter)
     // store(filter, toCString(options.filter_file));
 }
 
+// Queries the filter of a shard, its hits are reported as the bins from shard.first_bin on. A filter that does not
+// have the bins of the shard, e.g. a stale or swapped shard file, is rejected.
+inline void search_filter_file(Options & options, Shard const & shard, SampleMap const & samples, Stats & stats)
+{
+    IbfLayout layout = read_layout(shard.file_name);
+    if (layout.number_of_bins != shard.number_of_bins)
+        throw RuntimeError("The filter " + std::string(toCString(shard.file_name)) + " has " +
+                           std::to_string(layout.number_of_bins) + " bins, the manifest expects " +
+                           std::to_string(shard.number_of_bins) + ".");
+    options.window_size = check_window_size(options.window_size, layout);
+
+    dispatch_minimizer(layout.kmer_size, options.window_size, [&] (auto tag) {
+        Ibf<Dna5, typename decltype(tag)::Type> const filter(shard.file_name, options.window_size, options.mmap);
+        search_filter(options, filter, samples, shard.first_bin, stats);
+    });
+}
+
+// Queries the top level of a hierarchical filter and the lower levels of the technical bins that are hit.
+inline void search_hierarchy(Options & options, HierarchyManifest const & manifest, SampleMap const & samples,
+                             Stats & stats)
+{
+    IbfLayout layout = read_layout(manifest.top_level_file);
+    options.window_size = check_window_size(options.window_size, layout);
+
+    dispatch_minimizer(layout.kmer_size, options.window_size, [&] (auto tag) {
+        Hierarchy<Dna5, typename decltype(tag)::Type> const filter(options.filter_file, options.window_size,
+                                                                   options.mmap);
+        search_filter(options, filter, samples, 0, stats);
+    });
+}
+
+// Unites the binary results of the shards of a filter read by read.
+inline void merge_results(Options const & options, std::vector<CharString> const & partial_files,
+                          SampleMap const & samples, Stats & stats)
+{
+    StatsRecorder recorder(stats);
+    StageTimer timer(&recorder, STAGE_WRITE);
+    std::vector<std::unique_ptr<ResultReader>> readers;
+    for (auto const & partial_file : partial_files)
+        readers.emplace_back(new ResultReader(partial_file));
+
+    // The text format needs the read ids, which are taken from the query file again.
+    std::unique_ptr<SequenceFile> query_file;
+    if (options.output_format == RESULT_TEXT)
+        query_file.reset(new SequenceFile(options.query_file));
+
+    ResultWriter out(options.output_file, options.output_format, samples.names.size());
+    SampleSet hits(samples.names.size());
+    std::vector<uint32_t> found;
+    std::string text;
+    FastxRecord record{};
+    uint64_t read_index;
+    uint64_t next_record{0};
+    while (readers[0]->next(read_index, found))
+    {
+        for (uint32_t sample : found)
+            hits.insert(sample);
+        for (size_t r = 1; r < readers.size(); ++r)
+        {
+            uint64_t other_index;
+            if (!readers[r]->next(other_index, found) || other_index != read_index)
+                throw IOError("The results of the shards do not cover the same reads.");
+            for (uint32_t sample : found)
+                hits.insert(sample);
+        }
+        if (options.output_format == RESULT_TEXT)
+        {
+            for (; next_record <= read_index; ++next_record)
+            {
+                if (!query_file->next(record))
+                    throw IOError("The results of the shards do not match the query file.");
+            }
+        }
+        append_result(text, options.output_format, read_index, record.id, hits, samples);
+        if (text.size() >= (1ULL << 20))
+        {
+            out.write(text);
+            text.clear();
+        }
+    }
+    out.write(text);
+    out.close();
+}
+
 int main(int argc, char const ** argv)
 {
     ArgumentParser parser;
@@ -394,9 +515,50 @@ int main(int argc, char const ** argv)
 
     try
     {
-        typedef BDConfig<Dna5, Minimizer<19, 24>, Uncompressed> Config;
-        BinningDirectory<InterleavedBloomFilter, Config> const filter(options.filter_file, options.window_size);
-        search_filter(options, filter);
+        SampleMap samples;
+        Stats stats(options.stats);
+        CharString sample_map_file = options.filter_file;
+        append(sample_map_file, ".samples");
+
+        if (is_hierarchy_manifest(options.filter_file))
+        {
+            HierarchyManifest manifest;
+            retrieve(manifest, options.filter_file);
+            load_samples(samples, sample_map_file, manifest.number_of_bins);
+            search_hierarchy(options, manifest, samples, stats);
+            report_stats(stats, options.stats_file);
+            return 0;
+        }
+
+        if (!is_shard_manifest(options.filter_file))
+        {
+            IbfLayout layout = read_layout(options.filter_file);
+            load_samples(samples, sample_map_file, layout.number_of_bins);
+            search_filter_file(options, Shard{0, layout.number_of_bins, options.filter_file}, samples, stats);
+            report_stats(stats, options.stats_file);
+            return 0;
+        }
+
+        // Query the shards one after the other, each writes binary results that are merged at the end.
+        ShardManifest manifest;
+        retrieve(manifest, options.filter_file);
+        load_samples(samples, sample_map_file, manifest.number_of_bins);
+
+        Options shard_options = options;
+        shard_options.output_format = RESULT_BINARY;
+        std::vector<CharString> partial_files;
+        for (auto const & shard : manifest.shards)
+        {
+            shard_options.output_file = options.output_file;
+            append(shard_options.output_file, ".part");
+            append(shard_options.output_file, std::to_string(partial_files.size()));
+            partial_files.push_back(shard_options.output_file);
+            search_filter_file(shard_options, shard, samples, stats);
+        }
+        merge_results(options, partial_files, samples, stats);
+        for (auto const & partial_file : partial_files)
+            std::remove(toCString(partial_file));
+        report_stats(stats, options.stats_file);
     }
     catch (Exception const & e)
     {
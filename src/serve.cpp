@@ -0,0 +1,543 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#include <poll.h>
+#include <signal.h>
+
+#include <condition_variable>
+#include <exception>
+#include <list>
+#include <memory>
+#include <thread>
+
+#include <seqan/arg_parse.h>
+#include <seqan/binning_directory.h>
+
+#include "helper.h"
+#include "dispatch.h"
+#include "hierarchy.h"
+#include "ibf.h"
+#include "pipeline.h"
+#include "query_protocol.h"
+#include "result_writer.h"
+#include "sample_map.h"
+#include "shards.h"
+
+using namespace seqan;
+
+struct Options
+{
+    CharString  filter_file;
+    CharString  socket_path;
+
+    uint32_t    errors;
+    uint32_t    penalty;
+    uint32_t    window_size;
+    unsigned    threads;
+    uint32_t    chunk_size;
+    uint64_t    max_request_size;
+    bool        mmap;
+
+    Options():
+        errors(0),
+        penalty(0),
+        window_size(0),
+        threads(1),
+        chunk_size(1000),
+        max_request_size(1024),
+        mmap(false) {}
+};
+
+void setupArgumentParser(ArgumentParser & parser, Options const & options)
+{
+    setAppName(parser, "SRA_search serve prototype");
+
+    addArgument(parser, ArgParseArgument(ArgParseArgument::INPUT_FILE, "IBF FILE"));
+    setHelpText(parser, 0, "A file containing the IBF to query, or the manifest of a sharded or \
+                hierarchical filter");
+
+    addArgument(parser, ArgParseArgument(ArgParseArgument::STRING, "SOCKET"));
+    setHelpText(parser, 1, "The path of the Unix domain socket to listen on");
+
+    addSection(parser, "Query Options");
+
+    addOption(parser, ArgParseOption("t", "threads", "Specify the number of threads to use.", ArgParseOption::INTEGER));
+    setMinValue(parser, "threads", "1");
+    setMaxValue(parser, "threads", "2048");
+    setDefaultValue(parser, "threads", options.threads);
+
+    addOption(parser, ArgParseOption("c", "chunk-size", "Number of reads of a request that are queried as one unit of \
+                                     work.", ArgParseOption::INTEGER));
+    setMinValue(parser, "chunk-size", "1");
+    setDefaultValue(parser, "chunk-size", options.chunk_size);
+
+    addOption(parser, ArgParseOption("r", "max-request-size", "The largest request in MiB that is accepted. Larger \
+                                     requests are answered with an error and the connection is closed.",
+                                     ArgParseOption::INTEGER));
+    setMinValue(parser, "max-request-size", "1");
+    // 1 TiB, so that the limit in bytes fits into 64 bits.
+    setMaxValue(parser, "max-request-size", "1048576");
+    setDefaultValue(parser, "max-request-size", options.max_request_size);
+
+    addOption(parser, ArgParseOption("m", "mmap", "Map the filter file into memory and query it in place instead of \
+                                     loading it. The mapping is shared by all processes using the same filter."));
+
+    addOption(parser, ArgParseOption("e", "errors", "Maximum number of errors to allow.", ArgParseOption::INTEGER));
+    setMinValue(parser, "errors", "0");
+    setMaxValue(parser, "errors", "10");
+    setDefaultValue(parser, "errors", options.errors);
+
+    addOption(parser, ArgParseOption("p", "penalty", "Correctional value for threshold calculation", ArgParseOption::INTEGER));
+    setMinValue(parser, "penalty", "0");
+    setMaxValue(parser, "penalty", "10");
+    setDefaultValue(parser, "penalty", options.penalty);
+
+    addOption(parser, ArgParseOption("w", "window-size", "The size of the window for the IBF. \
+                                     Default: the window size stored in the filter, 24 if it has none.",
+                                     ArgParseOption::INTEGER));
+    setMinValue(parser, "window-size", "14");
+}
+
+ArgumentParser::ParseResult
+parseCommandLine(Options & options, ArgumentParser & parser, int argc, char const ** argv)
+{
+    ArgumentParser::ParseResult res = parse(parser, argc, argv);
+
+    if (res != ArgumentParser::PARSE_OK)
+        return res;
+
+    getArgumentValue(options.filter_file, parser, 0);
+    getArgumentValue(options.socket_path, parser, 1);
+
+    if (isSet(parser, "errors")) getOptionValue(options.errors, parser, "errors");
+    if (isSet(parser, "penalty")) getOptionValue(options.penalty, parser, "penalty");
+    if (isSet(parser, "window-size")) getOptionValue(options.window_size, parser, "window-size");
+    if (isSet(parser, "threads")) getOptionValue(options.threads, parser, "threads");
+    if (isSet(parser, "chunk-size")) getOptionValue(options.chunk_size, parser, "chunk-size");
+    if (isSet(parser, "max-request-size")) getOptionValue(options.max_request_size, parser, "max-request-size");
+    options.mmap = isSet(parser, "mmap");
+
+    return ArgumentParser::PARSE_OK;
+}
+
+// SIGINT and SIGTERM are turned into a byte on this pipe, which the accept loop polls.
+static int stop_pipe[2];
+
+extern "C" void request_stop(int)
+{
+    char byte{0};
+    ssize_t written = ::write(stop_pipe[1], &byte, 1);
+    (void) written;
+}
+
+// ----------------------------------------------------------------------------
+// Class QueryServer
+// ----------------------------------------------------------------------------
+// Keeps the filter, all shards of a sharded filter or all levels of a
+// hierarchical filter (TFilter is an Ibf or a Hierarchy) in memory and answers
+// the requests of any number of clients. Every connection is served by its
+// own thread, which parses a request and splits its reads into chunks for a
+// shared pool of query workers. The results of the chunks are sent back in
+// order once all chunks of the request are done.
+
+template <typename TFilter>
+class QueryServer
+{
+public:
+    typedef typename TFilter::TSelector         TSelector;
+
+    QueryServer(Options const & options, std::vector<Shard> const & shards, SampleMap const & samples) :
+        options(options),
+        samples(samples),
+        thresholds(options.errors, options.penalty),
+        tasks(4 * options.threads)
+    {
+        for (Shard const & shard : shards)
+        {
+            filters.emplace_back(new TFilter(shard.file_name, options.window_size, options.mmap));
+            // A stale or swapped shard file would map its hits onto the wrong bins.
+            if (getNumberOfBins(*filters.back()) != shard.number_of_bins)
+                throw RuntimeError("The filter " + std::string(toCString(shard.file_name)) + " has " +
+                                   std::to_string(getNumberOfBins(*filters.back())) + " bins, the manifest expects " +
+                                   std::to_string(shard.number_of_bins) + ".");
+            first_bins.push_back(shard.first_bin);
+        }
+    }
+
+    // Serves until stop_fd becomes readable.
+    void run(int listen_fd, int stop_fd)
+    {
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < options.threads; ++i)
+            workers.emplace_back([this] { work(); });
+
+        std::list<Connection> connections;
+        auto stop = [&] {
+            // Running requests are finished, but their clients will not receive the answers.
+            for (Connection & connection : connections)
+                ::shutdown(connection.fd, SHUT_RDWR);
+            for (Connection & connection : connections)
+            {
+                connection.thread.join();
+                ::close(connection.fd);
+            }
+            tasks.close();
+            for (std::thread & worker : workers)
+                worker.join();
+        };
+
+        try
+        {
+            accept_connections(listen_fd, stop_fd, connections);
+        }
+        catch (...)
+        {
+            stop();
+            throw;
+        }
+        stop();
+    }
+
+private:
+    struct Connection
+    {
+        int                 fd;
+        std::thread         thread;
+        std::atomic<bool>   finished;
+
+        explicit Connection(int fd) :
+            fd(fd),
+            finished(false) {}
+    };
+
+    // A request of a client, answered by the workers one chunk at a time.
+    struct Batch
+    {
+        std::string                 payload;
+        RecordBatch                 reads;
+        uint64_t                    first_read;
+        ResultFormat                format;
+        std::vector<std::string>    results;
+        uint64_t                    pending;
+        std::exception_ptr          error;
+        std::mutex                  mtx;
+        std::condition_variable     done;
+    };
+
+    struct Task
+    {
+        Batch *     batch;
+        uint64_t    chunk;
+    };
+
+    Options const &                     options;
+    SampleMap const &                   samples;
+    std::vector<std::unique_ptr<TFilter>> filters;
+    std::vector<uint64_t>               first_bins;
+    ThresholdTable                      thresholds;
+    ConcurrentQueue<Task>               tasks;
+
+    void accept_connections(int listen_fd, int stop_fd, std::list<Connection> & connections)
+    {
+        pollfd fds[2] = {{listen_fd, POLLIN, 0}, {stop_fd, POLLIN, 0}};
+        while (true)
+        {
+            if (::poll(fds, 2, -1) == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                throw IOError("Unable to wait for connections: " + std::string(std::strerror(errno)));
+            }
+            if (fds[1].revents)
+                return;
+
+            for (auto it = connections.begin(); it != connections.end();)
+            {
+                if (!it->finished)
+                {
+                    ++it;
+                    continue;
+                }
+                it->thread.join();
+                ::close(it->fd);
+                it = connections.erase(it);
+            }
+
+            int fd = ::accept(listen_fd, nullptr, nullptr);
+            if (fd == -1)
+                continue;
+            connections.emplace_back(fd);
+            Connection & connection = connections.back();
+            connection.thread = std::thread([this, &connection] {
+                try
+                {
+                    serve(connection.fd);
+                }
+                catch (std::exception const & e)
+                {
+                    std::cerr << "Connection failed: " << e.what() << std::endl;
+                }
+                connection.finished = true;
+            });
+        }
+    }
+
+    void serve(int fd)
+    {
+        ServerHello hello;
+        std::memcpy(hello.magic, server_magic, sizeof(hello.magic));
+        hello.version = protocol_version;
+        hello.number_of_samples = samples.names.size();
+        write_all(fd, &hello, sizeof(hello));
+
+        Batch batch;
+        QueryRequest request;
+        while (read_all(fd, &request, sizeof(request)))
+        {
+            if (std::memcmp(request.magic, request_magic, sizeof(request.magic)) != 0)
+                throw IOError("Invalid request.");
+            // The size comes from the client, check it before allocating. The payload is not read, so the
+            // connection cannot be continued.
+            if (request.size > (options.max_request_size << 20))
+            {
+                std::string error = "The request of " + std::to_string(request.size) + " bytes is larger than the "
+                                    "limit of " + std::to_string(options.max_request_size) + " MiB.";
+                write_response(fd, 1, error);
+                ::shutdown(fd, SHUT_RDWR);
+                throw IOError(error);
+            }
+            batch.payload.resize(request.size);
+            if (request.size > 0 && !read_all(fd, &batch.payload[0], request.size))
+                throw IOError("Connection closed in the middle of a message.");
+
+            std::string error;
+            try
+            {
+                answer(batch, request);
+            }
+            catch (std::exception const & e)
+            {
+                error = e.what();
+            }
+
+            if (!error.empty())
+            {
+                write_response(fd, 1, error);
+                continue;
+            }
+            QueryResponse response;
+            std::memcpy(response.magic, response_magic, sizeof(response.magic));
+            response.status = 0;
+            response.size = 0;
+            for (std::string const & result : batch.results)
+                response.size += result.size();
+            write_all(fd, &response, sizeof(response));
+            for (std::string const & result : batch.results)
+                write_all(fd, result.data(), result.size());
+        }
+    }
+
+    static void write_response(int fd, uint32_t status, std::string const & message)
+    {
+        QueryResponse response;
+        std::memcpy(response.magic, response_magic, sizeof(response.magic));
+        response.status = status;
+        response.size = message.size();
+        write_all(fd, &response, sizeof(response));
+        write_all(fd, message.data(), message.size());
+    }
+
+    void answer(Batch & batch, QueryRequest const & request)
+    {
+        batch.reads.clear();
+        FastxReader reader(std::unique_ptr<BlockSource>(new MemorySource(batch.payload)));
+        FastxRecord record;
+        while (reader.next(record))
+            batch.reads.push_back(record);
+
+        uint64_t const chunks = (length(batch.reads) + options.chunk_size - 1) / options.chunk_size;
+        batch.first_read = request.first_read;
+        batch.format = request.format == RESULT_BINARY ? RESULT_BINARY : RESULT_TEXT;
+        batch.results.assign(chunks, std::string());
+        batch.error = nullptr;
+        batch.pending = chunks;
+
+        uint64_t chunk{0};
+        while (chunk < chunks && tasks.push(Task{&batch, chunk}))
+            ++chunk;
+
+        // Chunks that were handed out must be done before the batch can be reused.
+        std::unique_lock<std::mutex> lock(batch.mtx);
+        batch.pending -= chunks - chunk;
+        batch.done.wait(lock, [&batch] { return batch.pending == 0; });
+        if (chunk < chunks)
+            throw RuntimeError("The server is shutting down.");
+        if (batch.error)
+            std::rethrow_exception(batch.error);
+    }
+
+    void work()
+    {
+        std::vector<std::unique_ptr<TSelector>> selectors;
+        for (auto const & filter : filters)
+            selectors.emplace_back(new TSelector(*filter));
+        uint64_t const kmer_size = getKmerSize(*filters[0]);
+        SampleSet hits(samples.names.size());
+
+        Task task;
+        while (tasks.pop(task))
+        {
+            Batch & batch = *task.batch;
+            std::string text;
+            std::exception_ptr error;
+            try
+            {
+                uint64_t const first = task.chunk * options.chunk_size;
+                uint64_t const last = std::min<uint64_t>(first + options.chunk_size, length(batch.reads));
+                for (uint64_t r = first; r < last; ++r)
+                {
+                    if (length(batch.reads[r]) < kmer_size)
+                        continue;
+                    for (size_t s = 0; s < selectors.size(); ++s)
+                    {
+                        for_each_bin(select(*selectors[s], batch.reads[r], thresholds), [&] (uint64_t bin_number) {
+                            hits.insert(samples.bin_to_sample[first_bins[s] + bin_number]);
+                        });
+                    }
+                    append_result(text, batch.format, batch.first_read + r, batch.reads.id(r), hits, samples);
+                }
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+
+            std::lock_guard<std::mutex> lock(batch.mtx);
+            batch.results[task.chunk] = std::move(text);
+            if (error && !batch.error)
+                batch.error = error;
+            if (--batch.pending == 0)
+                batch.done.notify_one();
+        }
+    }
+};
+
+int main(int argc, char const ** argv)
+{
+    ArgumentParser parser;
+    Options options;
+    setupArgumentParser(parser, options);
+
+    ArgumentParser::ParseResult res = parseCommandLine(options, parser, argc, argv);
+
+    if (res != ArgumentParser::PARSE_OK)
+        return res == ArgumentParser::PARSE_ERROR;
+
+    try
+    {
+        std::vector<Shard> shards;
+        uint64_t number_of_bins;
+        CharString layout_file = options.filter_file;
+        bool hierarchical = is_hierarchy_manifest(options.filter_file);
+        if (hierarchical)
+        {
+            // The hierarchy is served like a single filter, it reads its manifest itself.
+            HierarchyManifest manifest;
+            retrieve(manifest, options.filter_file);
+            number_of_bins = manifest.number_of_bins;
+            shards.push_back(Shard{0, number_of_bins, options.filter_file});
+            layout_file = manifest.top_level_file;
+        }
+        else if (is_shard_manifest(options.filter_file))
+        {
+            ShardManifest manifest;
+            retrieve(manifest, options.filter_file);
+            shards = manifest.shards;
+            number_of_bins = manifest.number_of_bins;
+            layout_file = shards[0].file_name;
+        }
+        else
+        {
+            number_of_bins = read_layout(options.filter_file).number_of_bins;
+            shards.push_back(Shard{0, number_of_bins, options.filter_file});
+        }
+
+        SampleMap samples;
+        CharString sample_map_file = options.filter_file;
+        append(sample_map_file, ".samples");
+        load_samples(samples, sample_map_file, number_of_bins);
+
+        IbfLayout layout = read_layout(layout_file);
+        options.window_size = check_window_size(options.window_size, layout);
+
+        if (::pipe(stop_pipe) == -1)
+            throw RuntimeError("Unable to create pipe.");
+        signal(SIGINT, request_stop);
+        signal(SIGTERM, request_stop);
+
+        dispatch_minimizer(layout.kmer_size, options.window_size, [&] (auto tag) {
+            typedef typename decltype(tag)::Type TMinimizer;
+            std::unique_ptr<QueryServer<Ibf<Dna5, TMinimizer>>> flat_server;
+            std::unique_ptr<QueryServer<Hierarchy<Dna5, TMinimizer>>> hierarchy_server;
+            if (hierarchical)
+                hierarchy_server.reset(new QueryServer<Hierarchy<Dna5, TMinimizer>>(options, shards, samples));
+            else
+                flat_server.reset(new QueryServer<Ibf<Dna5, TMinimizer>>(options, shards, samples));
+            int listen_fd = listen_socket(options.socket_path);
+            std::cerr << "Listening on " << options.socket_path << std::endl;
+            try
+            {
+                if (hierarchical)
+                    hierarchy_server->run(listen_fd, stop_pipe[0]);
+                else
+                    flat_server->run(listen_fd, stop_pipe[0]);
+            }
+            catch (...)
+            {
+                ::close(listen_fd);
+                ::unlink(toCString(options.socket_path));
+                throw;
+            }
+            ::close(listen_fd);
+            ::unlink(toCString(options.socket_path));
+        });
+    }
+    catch (Exception const & e)
+    {
+        std::cerr << getAppName(parser) << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,169 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#ifndef SRA_SEARCH_SHARDS_H_
+#define SRA_SEARCH_SHARDS_H_
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <seqan/sequence.h>
+
+using namespace seqan;
+
+// ----------------------------------------------------------------------------
+// Class ShardManifest
+// ----------------------------------------------------------------------------
+// A filter that is split into shards, each an independent filter over a
+// contiguous range of bins. The manifest is a text file that takes the place
+// of the filter file:
+//
+//   #SRA_search shards
+//   <number of bins>
+//   <first bin> <number of bins> <shard file>     (one line per shard)
+//
+// Shard files are stored relative to the directory of the manifest.
+
+struct Shard
+{
+    uint64_t    first_bin;
+    uint64_t    number_of_bins;
+    CharString  file_name;
+};
+
+struct ShardManifest
+{
+    uint64_t            number_of_bins;
+    std::vector<Shard>  shards;
+};
+
+static const std::string SHARD_MANIFEST_HEADER{"#SRA_search shards"};
+
+// ----------------------------------------------------------------------------
+// Function is_shard_manifest()
+// ----------------------------------------------------------------------------
+
+inline bool is_shard_manifest(CharString const & file_name)
+{
+    std::ifstream in(toCString(file_name), std::ios::binary);
+    std::string header(SHARD_MANIFEST_HEADER.size(), '\0');
+    in.read(&header[0], header.size());
+    return in && header == SHARD_MANIFEST_HEADER;
+}
+
+// ----------------------------------------------------------------------------
+// Function shard_manifest()
+// ----------------------------------------------------------------------------
+// Splits number_of_bins into number_of_shards ranges. The ranges are multiples
+// of 64 bins, so no shard wastes bits on a partially used word per block, and
+// the first words % number_of_shards shards get one word more than the rest.
+// There can be at most one shard per word.
+
+inline void shard_manifest(ShardManifest & me, CharString const & file_name, uint64_t number_of_bins,
+                           uint64_t number_of_shards)
+{
+    uint64_t words = (number_of_bins + 63) / 64;
+    if (number_of_shards == 0 || number_of_shards > words)
+        throw RuntimeError(std::to_string(number_of_bins) + " bins can be split into 1 to " + std::to_string(words) +
+                           " shards, not " + std::to_string(number_of_shards) + ".");
+
+    me.number_of_bins = number_of_bins;
+    me.shards.clear();
+    uint64_t first_bin{0};
+    for (uint64_t i = 0; i < number_of_shards; ++i)
+    {
+        uint64_t shard_words = words / number_of_shards + (i < words % number_of_shards);
+        Shard shard;
+        shard.first_bin = first_bin;
+        shard.number_of_bins = std::min(64 * shard_words, number_of_bins - first_bin);
+        first_bin += shard.number_of_bins;
+        shard.file_name = file_name;
+        append(shard.file_name, ".shard");
+        append(shard.file_name, std::to_string(me.shards.size()));
+        me.shards.push_back(shard);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Function store()
+// ----------------------------------------------------------------------------
+
+inline void store(ShardManifest const & me, CharString const & file_name)
+{
+    std::ofstream out(toCString(file_name));
+    out << SHARD_MANIFEST_HEADER << '\n' << me.number_of_bins << '\n';
+    for (auto const & shard : me.shards)
+    {
+        std::string shard_file = toCString(shard.file_name);
+        out << shard.first_bin << ' ' << shard.number_of_bins << ' '
+            << shard_file.substr(shard_file.find_last_of('/') + 1) << '\n';
+    }
+    if (!out)
+        throw IOError("Unable to write shard manifest: " + std::string(toCString(file_name)));
+}
+
+// ----------------------------------------------------------------------------
+// Function retrieve()
+// ----------------------------------------------------------------------------
+
+inline void retrieve(ShardManifest & me, CharString const & file_name)
+{
+    std::ifstream in(toCString(file_name));
+    std::string line;
+    if (!std::getline(in, line) || line != SHARD_MANIFEST_HEADER || !(in >> me.number_of_bins))
+        throw IOError("File: " + std::string(toCString(file_name)) + " is not a valid shard manifest!");
+
+    std::string manifest_file = toCString(file_name);
+    CharString directory = manifest_file.substr(0, manifest_file.find_last_of('/') + 1);
+    uint64_t next_bin{0};
+    me.shards.clear();
+    Shard shard;
+    std::string shard_file;
+    while (in >> shard.first_bin >> shard.number_of_bins >> shard_file)
+    {
+        if (shard.first_bin != next_bin)
+            throw IOError("Shard manifest " + std::string(toCString(file_name)) + " does not cover all bins.");
+        shard.file_name = directory;
+        append(shard.file_name, shard_file);
+        me.shards.push_back(shard);
+        next_bin += shard.number_of_bins;
+    }
+    if (next_bin != me.number_of_bins)
+        throw IOError("Shard manifest " + std::string(toCString(file_name)) + " does not cover all bins.");
+}
+
+#endif  // SRA_SEARCH_SHARDS_H_
@@ -0,0 +1,382 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#ifndef SRA_SEARCH_STATS_H_
+#define SRA_SEARCH_STATS_H_
+
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+#include <seqan/basic.h>
+#include <seqan/sequence.h>
+
+using namespace seqan;
+
+// ----------------------------------------------------------------------------
+// Stages and counters
+// ----------------------------------------------------------------------------
+
+enum Stage
+{
+    STAGE_READ,         // parsing input files, items are bases
+    STAGE_HASH,         // computing minimizers, items are minimizers
+    STAGE_THRESHOLD,    // looking up thresholds, items are reads
+    STAGE_INSERT,       // setting bits or counting k-mers, items are minimizers
+    STAGE_LOOKUP,       // loading and counting filter blocks, items are reads
+    STAGE_WRITE,        // formatting and writing output, items are bytes
+    NUMBER_OF_STAGES
+};
+
+static char const * const stage_names[NUMBER_OF_STAGES] = {"read", "hash", "threshold", "insert", "lookup", "write"};
+
+enum HardwareCounter
+{
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_LLC_MISSES,
+    COUNTER_BRANCH_MISSES,
+    NUMBER_OF_COUNTERS
+};
+
+static char const * const counter_names[NUMBER_OF_COUNTERS] = {"cycles", "instructions", "llc_misses",
+                                                               "branch_misses"};
+
+struct StageTotals
+{
+    uint64_t    ns[NUMBER_OF_STAGES];
+    uint64_t    calls[NUMBER_OF_STAGES];
+    uint64_t    items[NUMBER_OF_STAGES];
+    uint64_t    counters[NUMBER_OF_COUNTERS];
+    bool        has_counters;
+};
+
+// ----------------------------------------------------------------------------
+// Class Stats
+// ----------------------------------------------------------------------------
+// Where a run spends its time. Every thread records into its own
+// StatsRecorder without any synchronisation, the recorders are merged into
+// the Stats once when they are destroyed. Stage times are summed over all
+// threads, so they add up to more than the wall time with several threads.
+//
+// Hardware counters are read with perf_event_open for the whole lifetime of
+// a recorder, reading them per stage would cost a system call per read. They
+// are missing if the kernel does not permit it (perf_event_paranoid).
+
+class Stats
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    bool enabled;
+
+    explicit Stats(bool enabled = false) :
+        enabled(enabled),
+        start(Clock::now()),
+        threads(0),
+        totals{}
+    {}
+
+    void merge(StageTotals const & recorded)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        ++threads;
+        for (unsigned s = 0; s < NUMBER_OF_STAGES; ++s)
+        {
+            totals.ns[s] += recorded.ns[s];
+            totals.calls[s] += recorded.calls[s];
+            totals.items[s] += recorded.items[s];
+        }
+        if (recorded.has_counters)
+        {
+            totals.has_counters = true;
+            for (unsigned c = 0; c < NUMBER_OF_COUNTERS; ++c)
+                totals.counters[c] += recorded.counters[c];
+        }
+    }
+
+    // A table for humans.
+    void print(std::ostream & out)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        uint64_t total_ns{0};
+        for (unsigned s = 0; s < NUMBER_OF_STAGES; ++s)
+            total_ns += totals.ns[s];
+
+        char line[128];
+        std::snprintf(line, sizeof(line), "Wall time: %.3f s, threads: %u\n", seconds(start, Clock::now()), threads);
+        out << line;
+        std::snprintf(line, sizeof(line), "%-10s %10s %6s %12s %16s %14s\n", "stage", "seconds", "%", "calls", "items",
+                      "items/s");
+        out << line;
+        for (unsigned s = 0; s < NUMBER_OF_STAGES; ++s)
+        {
+            if (totals.calls[s] == 0)
+                continue;
+            double stage_seconds = totals.ns[s] / 1e9;
+            std::snprintf(line, sizeof(line), "%-10s %10.3f %6.1f %12llu %16llu %14.0f\n", stage_names[s],
+                          stage_seconds, 100.0 * totals.ns[s] / total_ns,
+                          static_cast<unsigned long long>(totals.calls[s]),
+                          static_cast<unsigned long long>(totals.items[s]),
+                          stage_seconds > 0 ? totals.items[s] / stage_seconds : 0.0);
+            out << line;
+        }
+        if (!totals.has_counters)
+        {
+            out << "Hardware counters: not available\n";
+            return;
+        }
+        for (unsigned c = 0; c < NUMBER_OF_COUNTERS; ++c)
+            out << counter_names[c] << ": " << totals.counters[c] << '\n';
+        if (totals.counters[COUNTER_CYCLES] > 0)
+            out << "IPC: " << static_cast<double>(totals.counters[COUNTER_INSTRUCTIONS]) /
+                              totals.counters[COUNTER_CYCLES] << '\n';
+    }
+
+    void write_json(CharString const & file_name)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::ofstream out(toCString(file_name));
+        out << "{\n  \"wall_seconds\": " << seconds(start, Clock::now()) << ",\n  \"threads\": " << threads
+            << ",\n  \"stages\": {";
+        for (unsigned s = 0; s < NUMBER_OF_STAGES; ++s)
+        {
+            out << (s ? "," : "") << "\n    \"" << stage_names[s] << "\": {\"seconds\": " << totals.ns[s] / 1e9
+                << ", \"calls\": " << totals.calls[s] << ", \"items\": " << totals.items[s] << "}";
+        }
+        out << "\n  },\n  \"counters\": ";
+        if (!totals.has_counters)
+        {
+            out << "null";
+        }
+        else
+        {
+            out << "{";
+            for (unsigned c = 0; c < NUMBER_OF_COUNTERS; ++c)
+                out << (c ? ", " : "") << "\"" << counter_names[c] << "\": " << totals.counters[c];
+            out << "}";
+        }
+        out << "\n}\n";
+        if (!out)
+            throw IOError("Unable to write stats file: " + std::string(toCString(file_name)));
+    }
+
+    static double seconds(Clock::time_point begin, Clock::time_point end)
+    {
+        return std::chrono::duration<double>(end - begin).count();
+    }
+
+private:
+    Clock::time_point   start;
+    unsigned            threads;
+    StageTotals         totals;
+    std::mutex          mtx;
+};
+
+// ----------------------------------------------------------------------------
+// Class StatsRecorder
+// ----------------------------------------------------------------------------
+// The thread-local part of a Stats. Must be created and destroyed on the
+// thread it records, which is what the hardware counters count.
+
+class StatsRecorder
+{
+public:
+    explicit StatsRecorder(Stats & stats) :
+        stats(stats),
+        enabled(stats.enabled),
+        totals{},
+        group_fd(-1)
+    {
+        if (enabled)
+            open_counters();
+    }
+
+    StatsRecorder(StatsRecorder const &) = delete;
+    StatsRecorder & operator=(StatsRecorder const &) = delete;
+
+    ~StatsRecorder()
+    {
+        if (!enabled)
+            return;
+        read_counters();
+        stats.merge(totals);
+    }
+
+    inline bool is_enabled() const
+    {
+        return enabled;
+    }
+
+    inline void add(Stage stage, uint64_t ns, uint64_t items)
+    {
+        totals.ns[stage] += ns;
+        ++totals.calls[stage];
+        totals.items[stage] += items;
+    }
+
+    inline void add_items(Stage stage, uint64_t items)
+    {
+        totals.items[stage] += items;
+    }
+
+private:
+    Stats &         stats;
+    bool            enabled;
+    StageTotals     totals;
+    int             group_fd;
+    int             counter_fds[NUMBER_OF_COUNTERS];
+
+    void open_counters()
+    {
+#if defined(__linux__) && defined(__NR_perf_event_open)
+        static const uint64_t configs[NUMBER_OF_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                             PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        for (unsigned c = 0; c < NUMBER_OF_COUNTERS; ++c)
+        {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[c];
+            attr.disabled = c == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            // pid 0 and cpu -1: the calling thread on any CPU.
+            counter_fds[c] = syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+            if (counter_fds[c] == -1)
+            {
+                close_counters(c);
+                return;
+            }
+            if (c == 0)
+                group_fd = counter_fds[0];
+        }
+        ioctl(group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    void read_counters()
+    {
+        if (group_fd == -1)
+            return;
+        uint64_t values[1 + NUMBER_OF_COUNTERS];
+        if (::read(group_fd, values, sizeof(values)) == static_cast<ssize_t>(sizeof(values)) &&
+            values[0] == NUMBER_OF_COUNTERS)
+        {
+            totals.has_counters = true;
+            for (unsigned c = 0; c < NUMBER_OF_COUNTERS; ++c)
+                totals.counters[c] = values[1 + c];
+        }
+        close_counters(NUMBER_OF_COUNTERS);
+    }
+
+    void close_counters(unsigned opened)
+    {
+        for (unsigned c = 0; c < opened; ++c)
+            ::close(counter_fds[c]);
+        group_fd = -1;
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Class StageTimer
+// ----------------------------------------------------------------------------
+// Adds the time from its construction to its destruction to a stage of a
+// recorder. Does nothing without an enabled recorder, so the timers can stay
+// in the hot paths.
+
+class StageTimer
+{
+public:
+    StageTimer(StatsRecorder * recorder, Stage stage, uint64_t items = 0) :
+        recorder(recorder && recorder->is_enabled() ? recorder : nullptr),
+        stage(stage),
+        items(items)
+    {
+        if (this->recorder)
+            begin = Stats::Clock::now();
+    }
+
+    ~StageTimer()
+    {
+        if (recorder)
+        {
+            recorder->add(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(Stats::Clock::now() -
+                                                                                       begin).count(), items);
+        }
+    }
+
+    inline void add_items(uint64_t count)
+    {
+        items += count;
+    }
+
+private:
+    StatsRecorder *             recorder;
+    Stage                       stage;
+    uint64_t                    items;
+    Stats::Clock::time_point    begin;
+};
+
+// ----------------------------------------------------------------------------
+// Function report_stats()
+// ----------------------------------------------------------------------------
+// Prints the stats to std::cerr and writes them as JSON to json_file, if set.
+
+inline void report_stats(Stats & stats, CharString const & json_file)
+{
+    if (!stats.enabled)
+        return;
+    stats.print(std::cerr);
+    if (!empty(json_file))
+        stats.write_json(json_file);
+}
+
+#endif  // SRA_SEARCH_STATS_H_
@@ -0,0 +1,94 @@
+// ==========================================================================
+//                              SRA_Search - Prototype
+// ==========================================================================
+// Copyright (c) 2018, Enrico Seiler, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Enrico Seiler or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL ENRICO SEILER OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Enrico Seiler <enrico.seiler@fu-berlin.de>
+// ==========================================================================
+
+#ifndef SRA_SEARCH_THRESHOLD_H_
+#define SRA_SEARCH_THRESHOLD_H_
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+// Class ThresholdTable
+// ----------------------------------------------------------------------------
+// Memoizes the minimizer threshold of a (k, w, errors, penalty) configuration
+// by read length: the threshold for the given number of errors, lowered by
+// penalty but never below one. The reads of a run have only a few different
+// lengths, so after the first read of every length a threshold costs one
+// lookup. The table is shared by all threads and filled lazily; two threads
+// may compute the same entry, they store the same value. Reads longer than
+// max_length are not memoized.
+
+class ThresholdTable
+{
+public:
+    ThresholdTable(uint32_t errors, uint32_t penalty, uint64_t max_length = 1ULL << 16) :
+        errors(errors),
+        penalty(penalty),
+        table(max_length + 1) {}
+
+    ThresholdTable(ThresholdTable const &) = delete;
+    ThresholdTable & operator=(ThresholdTable const &) = delete;
+
+    // hasher is the caller's BDHash for the configuration, it computes missing entries.
+    template <typename THash>
+    inline uint64_t get(THash & hasher, uint64_t length)
+    {
+        if (length >= table.size())
+            return compute(hasher, length);
+
+        // Entries hold the threshold plus one, zero marks an entry that is not computed yet.
+        uint32_t entry = table[length].load(std::memory_order_relaxed);
+        if (entry == 0)
+        {
+            entry = compute(hasher, length) + 1;
+            table[length].store(entry, std::memory_order_relaxed);
+        }
+        return entry - 1;
+    }
+
+private:
+    uint32_t                            errors;
+    uint32_t                            penalty;
+    std::vector<std::atomic<uint32_t>>  table;
+
+    template <typename THash>
+    inline uint64_t compute(THash & hasher, uint64_t length) const
+    {
+        uint64_t threshold = hasher.get_threshold(length, errors);
+        return (threshold > penalty + 1) ? threshold - penalty : 1;
+    }
+};
+
+#endif  // SRA_SEARCH_THRESHOLD_H_